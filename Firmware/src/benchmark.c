@@ -0,0 +1,175 @@
+// ============================================================================================== //
+//                                                                                                //
+//  This file is part of the ePro firmware.                                                       //
+//                                                                                                //
+//  Author:                                                                                       //
+//  Marcel Hasler <mahasler@gmail.com>                                                            //
+//                                                                                                //
+//  Copyright (c) 2010 - 2014                                                                     //
+//  Bonn-Rhein-Sieg University of Applied Sciences                                                //
+//                                                                                                //
+//  This program is free software: you can redistribute it and/or modify it under the terms       //
+//  of the GNU General Public License as published by the Free Software Foundation, either        //
+//  version 3 of the License, or (at your option) any later version.                              //
+//                                                                                                //
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;     //
+//  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     //
+//  See the GNU General Public License for more details.                                          //
+//                                                                                                //
+//  You should have received a copy of the GNU General Public License along with this program.    //
+//  If not, see <https://www.gnu.org/licenses/>.                                                  //
+//                                                                                                //
+// ============================================================================================== //
+
+#include "benchmark.h"
+#include "epro.h"
+#include "lcd.h"
+#include "message.h"
+#include "packet.h"
+#include "timer.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Throughput test, a fixed message sent a few times in one session
+#define _BENCHMARK_MESSAGE_LENGTH 200
+#define _BENCHMARK_TRANSFER_COUNT 5
+
+// Private functions
+static void _benchmark_start(void);
+static uint16_t _benchmark_stop(void);
+static void _benchmark_show(void);
+static void _benchmark_wait_for_key(void);
+
+
+void benchmark_run()
+{
+    lcd_clear();
+    lcd_printf_PSTR(0, "Running...");
+
+    _benchmark_show();
+    _benchmark_wait_for_key();
+}
+
+
+void benchmark_run_throughput()
+{
+    // Same rate as 'Read message' on the receiving device
+    epro_set_bitrate_hint(BITRATE_HINT_SLOW_REGULAR);
+
+    char *string = (char*)malloc(_BENCHMARK_MESSAGE_LENGTH + 1);
+    if (!string)
+        return;
+
+    for (uint8_t i = 0; i < _BENCHMARK_MESSAGE_LENGTH; ++i)
+        string[i] = 'a' + i % 26;
+
+    string[_BENCHMARK_MESSAGE_LENGTH] = '\0';
+
+    message_t message;
+    message_init(&message, string, 0);
+    free(string);
+
+    uint16_t packet_count = message_get_packet_count(&message);
+
+    lcd_clear();
+    lcd_printf_PSTR(0, "Sending...");
+
+    // Link training happens here & isn't timed
+    result_t result = epro_open_tx_session();
+
+    uint32_t elapsed = 0;
+    for (uint8_t i = 0; i < _BENCHMARK_TRANSFER_COUNT && result == RESULT_SUCCESS; ++i)
+    {
+        timer_t timer;
+        timer_start(&timer);
+        result = epro_send_message(&message);
+        elapsed += timer.msecs;
+        timer_stop(&timer);
+    }
+
+    epro_close_session();
+    message_free(&message);
+
+    lcd_clear();
+    if (result == RESULT_SUCCESS)
+    {
+        // Message text per second, headers & framing not counted
+        uint32_t rate = (uint32_t)_BENCHMARK_MESSAGE_LENGTH * _BENCHMARK_TRANSFER_COUNT * 1000;
+        rate /= (elapsed > 0) ? elapsed : 1;
+
+        lcd_printf_PSTR(0, "%ux%u %lums", _BENCHMARK_TRANSFER_COUNT, packet_count, elapsed);
+        lcd_printf_PSTR(1, "%lu B/s", rate);
+    }
+    else
+        lcd_printf_PSTR(0, "Transfer failed");
+
+    _benchmark_wait_for_key();
+}
+
+
+void _benchmark_start()
+{
+    // Count CPU cycles with interrupts disabled
+    cli();
+    TCCR1A = 0x00;
+    TCCR1B = (1<<CS10);
+    TCNT1 = 0;
+}
+
+
+uint16_t _benchmark_stop()
+{
+    uint16_t cycles = TCNT1;
+    TCCR1B = 0x00;
+    sei();
+
+    return cycles;
+}
+
+
+void _benchmark_show()
+{
+    const uint8_t data[EPRO_BLOCK_LENGTH] = { 'e', 'P', 'r', 'o', 0x13, 0x42, 0x07, 0x7e };
+
+    packet_t packet;
+    packet_init(&packet, 1, 2, data, EPRO_BLOCK_LENGTH);
+
+    packet_frame_t frame;
+    packet_frame_encode(&frame, &packet);
+
+    // Measure timer overhead
+    _benchmark_start();
+    uint16_t overhead = _benchmark_stop();
+
+    // Additive checksum over data block
+    _benchmark_start();
+    volatile uint8_t checksum = packet_compute_checksum(&packet);
+    uint16_t checksum_cycles = _benchmark_stop() - overhead;
+
+    // CRC-16 over binary header & data block
+    _benchmark_start();
+    volatile uint16_t crc = packet_compute_crc16(frame.data + 1, 5 + EPRO_BLOCK_LENGTH);
+    uint16_t crc_cycles = _benchmark_stop() - overhead;
+
+    (void)checksum;
+    (void)crc;
+
+    lcd_printf_PSTR(0, "Sum:   %5u cyc", checksum_cycles);
+    lcd_printf_PSTR(1, "CRC16: %5u cyc", crc_cycles);
+}
+
+
+void _benchmark_wait_for_key()
+{
+    // Wait for user to return
+    while (1)
+    {
+        epro_poll_keys();
+        if (epro_is_key_pressed(KEY_OK) || epro_is_key_pressed(KEY_BACK))
+            return;
+    }
+}
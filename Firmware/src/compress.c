@@ -0,0 +1,247 @@
+// ============================================================================================== //
+//                                                                                                //
+//  This file is part of the ePro firmware.                                                       //
+//                                                                                                //
+//  Author:                                                                                       //
+//  Marcel Hasler <mahasler@gmail.com>                                                            //
+//                                                                                                //
+//  Copyright (c) 2010 - 2014                                                                     //
+//  Bonn-Rhein-Sieg University of Applied Sciences                                                //
+//                                                                                                //
+//  This program is free software: you can redistribute it and/or modify it under the terms       //
+//  of the GNU General Public License as published by the Free Software Foundation, either        //
+//  version 3 of the License, or (at your option) any later version.                              //
+//                                                                                                //
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;     //
+//  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     //
+//  See the GNU General Public License for more details.                                          //
+//                                                                                                //
+//  You should have received a copy of the GNU General Public License along with this program.    //
+//  If not, see <https://www.gnu.org/licenses/>.                                                  //
+//                                                                                                //
+// ============================================================================================== //
+
+
+#include "compress.h"
+#include "types.h"
+
+#include <avr/pgmspace.h>
+
+#include <string.h>
+
+#if EPRO_COMPRESSION_ENABLED
+
+// Built from resource/messages.txt by scripts/mkdict.py, so it is tuned to the
+// bundled messages. Entries like "Oscar Wi" only pay off for those, other text
+// compresses less. Rebuild the table when the messages change.
+#define _COMPRESS_DICTIONARY_SIZE 114
+
+static const char _compress_dictionary[_COMPRESS_DICTIONARY_SIZE][COMPRESS_WORD_LENGTH + 1] PROGMEM =
+{
+    "en",
+    "er",
+    "ch",
+    ". [",
+    " ist ",
+    "ei",
+    "e ",
+    " d",
+    "n ",
+    "s ",
+    "t ",
+    "an",
+    "Oscar Wi",
+    ", ",
+    "st",
+    "au",
+    "un",
+    "ss",
+    "el",
+    "zu ",
+    "li",
+    " s",
+    "in",
+    "hr",
+    "wi",
+    "ur",
+    "ni",
+    "ueck",
+    "al",
+    "eb",
+    "or",
+    "m ",
+    "ol",
+    "e]",
+    " Leute,",
+    "ed",
+    "ha",
+    "d ",
+    " v",
+    "et",
+    "wa",
+    "mm",
+    "ig",
+    " i",
+    " b",
+    ". ",
+    "ae",
+    "oh",
+    "ld",
+    "ri",
+    "at",
+    " k",
+    "Wi",
+    "es",
+    " G",
+    "mi",
+    "as",
+    "so",
+    "ar",
+    "Er",
+    "ma",
+    "us",
+    "Un",
+    "eh",
+    "ultivi",
+    "be",
+    "hl",
+    "eg",
+    "Al",
+    "ck",
+    " Ja",
+    "nt",
+    " M",
+    "Di",
+    "gl",
+    "da",
+    "ro",
+    "Da",
+    " L",
+    "eu",
+    "de",
+    "si",
+    "Wa",
+    "Ge",
+    "is",
+    "nd",
+    "la",
+    " moe",
+    "le",
+    "te",
+    "su",
+    "fg",
+    "Go",
+    "Zwe",
+    " N",
+    "ut",
+    " P",
+    " e",
+    "n]",
+    "em",
+    "ne",
+    " D",
+    "k ",
+    "ge",
+    "ft",
+    "re",
+    " H",
+    " w",
+    "l]",
+    " n",
+    "Jea",
+    "eza",
+    " V",
+    "ag",
+};
+
+
+// Private functions
+static uint8_t _compress_match(const char *string, uint8_t word);
+
+
+uint16_t compress_string(const char *string, uint8_t *data)
+{
+    uint16_t length = 0;
+
+    while (*string)
+    {
+        if ((uint8_t)*string >= 0x80)
+            return 0;
+
+        // Greedy longest match
+        uint8_t best_word = 0;
+        uint8_t best_length = 1;
+        for (uint8_t i = 0; i < _COMPRESS_DICTIONARY_SIZE; ++i)
+        {
+            uint8_t match = _compress_match(string, i);
+            if (match > best_length)
+            {
+                best_word = i;
+                best_length = match;
+            }
+        }
+
+        data[length++] = (best_length > 1) ? (0x80 | best_word) : (uint8_t)*string;
+        string += best_length;
+    }
+
+    data[length++] = '\0';
+    return length;
+}
+
+
+uint16_t compress_get_string_length(const uint8_t *data, uint16_t length)
+{
+    uint16_t string_length = 0;
+
+    for (uint16_t i = 0; i < length && data[i] != '\0'; ++i)
+    {
+        if (data[i] < 0x80)
+            string_length++;
+        else if ((data[i] & 0x7f) < _COMPRESS_DICTIONARY_SIZE)
+            string_length += strlen_P(_compress_dictionary[data[i] & 0x7f]);
+    }
+
+    return string_length;
+}
+
+
+void compress_expand(const uint8_t *data, uint16_t length, char *string)
+{
+    for (uint16_t i = 0; i < length && data[i] != '\0'; ++i)
+    {
+        if (data[i] < 0x80)
+            *string++ = data[i];
+        else if ((data[i] & 0x7f) < _COMPRESS_DICTIONARY_SIZE)
+        {
+            strcpy_P(string, _compress_dictionary[data[i] & 0x7f]);
+            string += strlen(string);
+        }
+    }
+
+    *string = '\0';
+}
+
+
+uint8_t _compress_match(const char *string, uint8_t word)
+{
+    // Length of the word if the string starts with it, 0 otherwise
+    const char *letters = _compress_dictionary[word];
+
+    uint8_t length = 0;
+    while (length < COMPRESS_WORD_LENGTH)
+    {
+        char letter = pgm_read_byte(&letters[length]);
+        if (letter == '\0')
+            break;
+
+        if (string[length] != letter)
+            return 0;
+
+        length++;
+    }
+
+    return length;
+}
+
+#endif // EPRO_COMPRESSION_ENABLED
@@ -0,0 +1,41 @@
+// ============================================================================================== //
+//                                                                                                //
+//  This file is part of the ePro firmware.                                                       //
+//                                                                                                //
+//  Author:                                                                                       //
+//  Marcel Hasler <mahasler@gmail.com>                                                            //
+//                                                                                                //
+//  Copyright (c) 2010 - 2014                                                                     //
+//  Bonn-Rhein-Sieg University of Applied Sciences                                                //
+//                                                                                                //
+//  This program is free software: you can redistribute it and/or modify it under the terms       //
+//  of the GNU General Public License as published by the Free Software Foundation, either        //
+//  version 3 of the License, or (at your option) any later version.                              //
+//                                                                                                //
+//  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;     //
+//  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     //
+//  See the GNU General Public License for more details.                                          //
+//                                                                                                //
+//  You should have received a copy of the GNU General Public License along with this program.    //
+//  If not, see <https://www.gnu.org/licenses/>.                                                  //
+//                                                                                                //
+// ============================================================================================== //
+
+
+#ifndef EPRO_COMPRESS_H
+#define EPRO_COMPRESS_H
+
+#include <stdint.h>
+
+// Longest substring the dictionary replaces by a single byte
+#define COMPRESS_WORD_LENGTH 8
+
+// Replaces frequent substrings by bytes >= 0x80 from a static dictionary. The
+// output includes the terminating NUL and is never longer than the input,
+// returns 0 for strings with bytes >= 0x80, which can't be compressed.
+uint16_t compress_string(const char *string, uint8_t *data);
+
+uint16_t compress_get_string_length(const uint8_t *data, uint16_t length);
+void compress_expand(const uint8_t *data, uint16_t length, char *string);
+
+#endif // EPRO_COMPRESS_H
@@ -34,6 +34,127 @@
 
 #define EPRO_BLOCK_LENGTH 8
 
+// Number of packets sent before polling for a cumulative acknowledgement,
+// 1 selects the original stop-and-wait protocol
+#define EPRO_TRANSPORT_WINDOW_SIZE 1
+
+#define EPRO_TRANSPORT_MAX_ATTEMPTS 3
+
+// Bounds in ms for the retransmission timeout, which is adapted to the
+// measured round trip time and starts out at the maximum
+#define EPRO_TRANSPORT_MIN_RTO 5
+#define EPRO_TRANSPORT_MAX_RTO 1000
+
+// Factor the timeout grows by after each lost acknowledgement
+#define EPRO_TRANSPORT_RTO_BACKOFF 2
+
+// Receive timeouts in ms, for the gap between two bytes of a frame and
+// between two packets of a message. Waiting for the first packet of a
+// message is not limited.
+#define EPRO_RX_BYTE_TIMEOUT 10
+#define EPRO_RX_PACKET_TIMEOUT 2000
+
+// Time in ms a driver gets to send a frame nobody answers right away, a
+// packet in windowed mode or an acknowledgement. Covers the longest frame
+// at the slowest rate.
+#define EPRO_TX_FRAME_TIMEOUT 1000
+
+// Packets a driver buffers while the transport is busy in windowed mode.
+// Receivers advertise these plus the packet being read as credit, senders
+// never send more than that before polling.
+#define EPRO_RX_QUEUE_LENGTH 2
+
+// Rate of the fast standard hint on RS-232. 250000, 500000 or 1000000 can be
+// used on short bench links, these are exact at 8 MHz.
+#define EPRO_RS232_FAST_BAUDRATE 115200
+
+// RS-232 receivers measure the rate of the sender from the first magic number
+// and ignore the bitrate hint. Works for senders between 2400 & 125000 baud
+// that send the byte after the magic number without a gap.
+#define EPRO_RS232_AUTOBAUD_ENABLED false
+
+// Share one RS-232/RS-485 line between several boards. Each transmission
+// starts with the address of its destination in a 9-bit frame, boards not
+// addressed ignore the rest in hardware (MPCM). Addresses are set in the
+// administration menu. Both ends need to enable this option.
+#define EPRO_RS232_MULTIDROP_ENABLED false
+
+// Sizes of the UART transmit & receive ring buffers, powers of two up to 128.
+// The receive buffer holds what arrives while the transport is busy.
+#define EPRO_UART_TX_BUFFER_SIZE 32
+#define EPRO_UART_RX_BUFFER_SIZE 64
+
+// Number of received messages kept in RAM. Senders announce each message by
+// its digest first and skip the packets if the receiver holds a copy already.
+// 0 disables the cache, which requires a window size above 1.
+#define EPRO_MESSAGE_CACHE_SIZE 0
+
+// Stream the whole message back to back and poll for a single acknowledgement
+// at its end, instead of one per window. Requires a window size above 1.
+#define EPRO_TRANSPORT_BURST_ENABLED false
+
+// Acknowledge with a bitmap of missing packets, the sender then repeats only
+// those from a buffer of one window of packets. Requires a window size above 1.
+#define EPRO_TRANSPORT_SELECTIVE_REPEAT false
+
+// Keep partially received messages & let the sender continue from the first
+// packet missing instead of starting over. Requires a window size above 1.
+#define EPRO_TRANSPORT_RESUME_ENABLED false
+
+// Negotiate the fastest working bitrate hint once per session, starting from
+// the hint selected by the menu. Both ends need to enable this option.
+// Receivers keep a negotiated rate until the sender has been silent for
+// EPRO_RX_PACKET_TIMEOUT ms.
+#define EPRO_LINK_TRAINING_ENABLED false
+
+// Probe frames sent per bitrate & how many of them may fail
+#define EPRO_LINK_PROBE_COUNT 8
+#define EPRO_LINK_MAX_PROBE_ERRORS 1
+
+// Receiver falls back to the base rate after this many ms without a frame while probing
+#define EPRO_LINK_TIMEOUT 200
+
+// Send packets with the binary header (wire format v2) instead of the ASCII
+// index/total fields, receivers accept both formats
+#define EPRO_BINARY_HEADER_ENABLED false
+
+// Protect binary frames with a CRC-16 over header and data instead of the
+// additive checksum, requires EPRO_BINARY_HEADER_ENABLED
+#define EPRO_CRC16_ENABLED false
+
+// Maximum payload per packet, a multiple of EPRO_BLOCK_LENGTH up to 64 bytes.
+// Larger payloads carry several cipher blocks per frame and require
+// EPRO_BINARY_HEADER_ENABLED.
+#define EPRO_PACKET_MAX_PAYLOAD EPRO_BLOCK_LENGTH
+
+// Wrap frames with Consistent Overhead Byte Stuffing, the magic number then
+// only appears as frame delimiter. Both ends need to enable this option.
+#define EPRO_COBS_FRAMING_ENABLED false
+
+// Append two Reed-Solomon parity bytes to binary frames, the receiver
+// corrects a single corrupted byte without a retransmission.
+// Requires EPRO_BINARY_HEADER_ENABLED.
+#define EPRO_FEC_ENABLED false
+
+// Compress message text with a static dictionary before ciphering, see
+// compress.c. The dictionary is tuned to the bundled messages & both sides
+// need the same one.
+#define EPRO_COMPRESSION_ENABLED false
+
+// Number of logical streams sharing one interface, see epro_send_streams().
+// Requires binary headers & the stop-and-wait transport.
+#define EPRO_STREAM_COUNT 1
+
+// Let epro_exchange_messages() send a message & read the other end's at the
+// same time over RS-232. Packets carry the acknowledgement for the opposite
+// direction, separate ones are only sent by an end with nothing left to send.
+// Requires binary headers & the stop-and-wait transport.
+#define EPRO_FULL_DUPLEX_ENABLED false
+
+// Time in ms epro_exchange_messages() waits for the other end to answer
+// before giving up, up to 65000. 0 waits until aborted.
+#define EPRO_EXCHANGE_TIMEOUT 30000
+
 #define EPRO_LCD_WIDTH 16
 
 #define EPRO_DEFAULT_INTERFACE_INDEX 0
@@ -54,6 +175,10 @@
 
 #define EPRO_DEFAULT_DEBUG false
 
+// Own bus address & the one messages are sent to, see EPRO_RS232_MULTIDROP_ENABLED
+#define EPRO_DEFAULT_BUS_ADDRESS 1
+#define EPRO_DEFAULT_BUS_PEER 1
+
 #define EPRO_SCROLL_DELAY 300
 
 #endif // EPRO_CONFIG_H
@@ -85,12 +85,164 @@ static uint8_t old_key_state = 0x00;
 static interface_driver_t current_interface;
 static bitrate_hint_t current_bitrate_hint = BITRATE_HINT_SLOW_REGULAR;
 
+// Direction the interface is kept open for, if any
+typedef enum
+{
+    _EPRO_SESSION_NONE,
+    _EPRO_SESSION_TX,
+    _EPRO_SESSION_RX
+
+} _epro_session_t;
+
+static _epro_session_t current_session = _EPRO_SESSION_NONE;
+
+// Round trip estimate for the current link, srtt is scaled by 8 and rttvar
+// by 4 as in RFC 6298. Reset whenever the interface or bitrate changes.
+typedef struct
+{
+    bitrate_hint_t hint;
+    bool valid;
+
+    uint16_t srtt;
+    uint16_t rttvar;
+    uint16_t rto;
+
+} _epro_rtt_t;
+
+static _epro_rtt_t rtt = { BITRATE_HINT_COUNT, false, 0, 0, EPRO_TRANSPORT_MAX_RTO };
+
+// Time spent in the last call to _epro_wait_for_interface()
+static uint16_t wait_time = 0;
+
+#if EPRO_TRANSPORT_WINDOW_SIZE > 1
+// Credit advertised to senders, the driver queue plus the packet being read
+#define _EPRO_RX_CREDIT (EPRO_RX_QUEUE_LENGTH + 1)
+#endif
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+// Packets of the window being sent, repeats are taken from here instead of
+// being built from the message again. Packet i goes to slot (i - 1) % size.
+static packet_t tx_window[EPRO_TRANSPORT_WINDOW_SIZE];
+#endif
+
+#if EPRO_STREAM_COUNT > 1
+// Reassembly context of each stream
+typedef struct
+{
+    message_t message;
+    message_assembly_t assembly;
+
+} _epro_stream_t;
+
+static _epro_stream_t streams[EPRO_STREAM_COUNT];
+#endif
+
+// Messages are announced by their digest before any packets are sent, so
+// receivers can resume interrupted transfers & skip messages they hold already
+#define _EPRO_ANNOUNCE_ENABLED (EPRO_TRANSPORT_RESUME_ENABLED || EPRO_MESSAGE_CACHE_SIZE > 0)
+
+#if _EPRO_ANNOUNCE_ENABLED
+// Announces the message about to be sent, uses index 0 like link training
+#define _EPRO_MESSAGE_ANNOUNCE 'M'
+
+// Digest of the message announced last
+static uint32_t announced_digest = 0;
+#endif
+
+#if EPRO_TRANSPORT_RESUME_ENABLED
+// Partially received message, kept until the sender resumes or the session is closed
+static message_t partial_message;
+static message_assembly_t partial_assembly;
+#endif
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+// Messages received during the session, replaced round robin
+typedef struct
+{
+    uint32_t digest;
+    uint16_t packet_count;
+    message_t message;
+
+} _epro_cache_entry_t;
+
+static _epro_cache_entry_t cache[EPRO_MESSAGE_CACHE_SIZE];
+static uint8_t cache_next = 0;
+#endif
+
+#if EPRO_LINK_TRAINING_ENABLED
+// Link training packets use index 0, which is never used by messages
+typedef enum
+{
+    _EPRO_LINK_PROPOSE = 'T',
+    _EPRO_LINK_PROBE   = 'P',
+    _EPRO_LINK_COMMIT  = 'C'
+
+} _epro_link_t;
+
+// Fastest hint worth probing, lowered when errors climb at a negotiated rate
+static bitrate_hint_t link_ceiling = BITRATE_HINT_COUNT - 1;
+
+// Rate negotiated for the open session, BITRATE_HINT_COUNT until trained
+static bitrate_hint_t link_hint = BITRATE_HINT_COUNT;
+
+// Receivers hold a negotiated rate until the sender has been silent for the packet timeout
+#define _EPRO_LINK_FALLBACK_DELAY (EPRO_RX_PACKET_TIMEOUT + EPRO_LINK_TIMEOUT)
+#endif
+
 // Forward declarations (private functions)
 static void _epro_initialize_lcd(void);
 static void _epro_initialize_keys(void);
 
+static void _epro_initialize_interface(_epro_session_t direction);
+static void _epro_shutdown_interface(void);
+
+static result_t _epro_wait_for_interface(uint16_t timeout);
+
+static void _epro_select_rtt(bitrate_hint_t hint);
+static void _epro_update_rtt(uint16_t sample);
+static void _epro_backoff_rtt(void);
 static result_t _epro_send_packet(const packet_t *packet);
-static result_t _epro_read_packet(packet_t *packet);
+static result_t _epro_read_packet(packet_t *packet, uint16_t timeout);
+#if EPRO_TRANSPORT_WINDOW_SIZE <= 1
+static result_t _epro_transfer_packet(const packet_t *packet);
+#endif
+
+static result_t _epro_send_packets(const message_t *message, uint16_t num_packets, uint16_t *acknowledged);
+static result_t _epro_read_packets(message_t *message, message_assembly_t *assembly, uint16_t timeout);
+
+#if EPRO_TRANSPORT_WINDOW_SIZE > 1
+static result_t _epro_send_packets_windowed(const message_t *message, uint16_t num_packets, uint16_t *acknowledged);
+static result_t _epro_read_packets_windowed(message_t *message, message_assembly_t *assembly, uint16_t timeout);
+#endif
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+static const packet_t *_epro_get_window_packet(const message_t *message, uint16_t index);
+#endif
+
+#if _EPRO_ANNOUNCE_ENABLED
+static result_t _epro_announce_message(const message_t *message, uint16_t num_packets, packet_ack_t *ack);
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED
+static result_t _epro_exchange_packets(const message_t *tx_message, uint16_t num_packets,
+                                       message_t *rx_message, message_assembly_t *assembly);
+#endif
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+static void _epro_cache_message(const message_t *message);
+static bool _epro_find_cached_message(uint32_t digest, uint16_t packet_count, message_t *message);
+static void _epro_free_cache(void);
+#endif
+
+#if EPRO_STREAM_COUNT > 1
+static void _epro_free_streams(void);
+#endif
+
+#if EPRO_LINK_TRAINING_ENABLED
+static result_t _epro_train_link(void);
+static result_t _epro_accept_link(void);
+static result_t _epro_send_link_packet(_epro_link_t type, bitrate_hint_t hint, uint16_t timeout, uint8_t attempts);
+#endif
 
 
 // Interrupt handler for key timer, used to debounce key presses. The state
@@ -136,6 +288,15 @@ void epro_initialize(interface_t interface)
 
 void epro_select_interface(interface_t interface)
 {
+    epro_close_session();
+
+    // Round trip times measured on another interface don't apply
+    rtt.hint = BITRATE_HINT_COUNT;
+
+#if EPRO_LINK_TRAINING_ENABLED
+    link_ceiling = BITRATE_HINT_COUNT - 1;
+#endif
+
     switch (interface)
     {
         case INTERFACE_RS232:
@@ -163,7 +324,28 @@ void epro_select_interface(interface_t interface)
 void epro_set_bitrate_hint(bitrate_hint_t hint)
 {
     current_bitrate_hint = hint;
+    _epro_select_rtt(hint);
+
+#if EPRO_LINK_TRAINING_ENABLED
+    link_ceiling = BITRATE_HINT_COUNT - 1;
+    link_hint = BITRATE_HINT_COUNT;
+#endif
+
+    // Apply to open session, drivers skip this if the hint didn't change
+    if (current_session == _EPRO_SESSION_TX)
+        current_interface.initialize_tx(hint);
+    else if (current_session == _EPRO_SESSION_RX)
+        current_interface.initialize_rx(hint);
+}
+
+
+#if EPRO_RS232_MULTIDROP_ENABLED
+void epro_set_bus_addresses(uint8_t address, uint8_t peer)
+{
+    // Only RS-232 supports multi-drop lines, the addresses apply whenever it is selected
+    rs232_set_bus_addresses(address, peer);
 }
+#endif
 
 
 bool epro_get_input(const char *caption, uint8_t *input, uint8_t length, bool digits_only)
@@ -360,9 +542,9 @@ result_t epro_send_packet(const packet_t *packet)
 {
     result_t result = RESULT_FAILED;
 
-    current_interface.initialize_tx(current_bitrate_hint);
+    _epro_initialize_interface(_EPRO_SESSION_TX);
     result = _epro_send_packet(packet);
-    current_interface.shutdown();
+    _epro_shutdown_interface();
 
     return result;
 }
@@ -372,9 +554,9 @@ result_t epro_read_packet(packet_t *packet)
 {
     result_t result = RESULT_FAILED;
 
-    current_interface.initialize_rx(current_bitrate_hint);
-    result = _epro_read_packet(packet);
-    current_interface.shutdown();
+    _epro_initialize_interface(_EPRO_SESSION_RX);
+    result = _epro_read_packet(packet, 0);
+    _epro_shutdown_interface();
 
     return result;
 }
@@ -384,32 +566,57 @@ result_t epro_send_message(const message_t *message)
 {
     result_t result = RESULT_FAILED;
 
-    packet_t *packets = 0;
-    uint16_t num_packets = 0;
-    message_to_packets(message, &packets, &num_packets);
-    if (!packets)
+    // Packets are generated one at a time while sending
+    uint16_t num_packets = message_get_packet_count(message);
+    if (num_packets == 0)
         return RESULT_ERROR;
 
-    current_interface.initialize_tx(current_bitrate_hint);
-    for (uint16_t i = 0; i < num_packets; ++i)
+    // Packets acknowledged so far, a transfer resumes from here after falling back
+    uint16_t acknowledged = 0;
+
+    _epro_initialize_interface(_EPRO_SESSION_TX);
+#if EPRO_LINK_TRAINING_ENABLED
+    while (1)
     {
-        uint8_t attempts = 0;
-        result = RESULT_FAILED;
-        while (result == RESULT_FAILED)
+        // Trained once per session. At the base rate the receiver waits for a
+        // commit before each message, at a negotiated rate it stays tuned in.
+        if (link_hint == BITRATE_HINT_COUNT)
+            result = _epro_train_link();
+        else if (link_hint == current_bitrate_hint)
+            result = _epro_send_link_packet(_EPRO_LINK_COMMIT, link_hint, EPRO_TRANSPORT_MAX_RTO,
+                                            EPRO_TRANSPORT_MAX_ATTEMPTS);
+        else
+            result = RESULT_SUCCESS;
+
+        if (result == RESULT_SUCCESS)
+            result = _epro_send_packets(message, num_packets, &acknowledged);
+
+        // Errors climbed at the negotiated rate, let the receiver fall back & retrain below it
+        if (result != RESULT_SUCCESS && result != RESULT_ABORTED &&
+            link_hint != BITRATE_HINT_COUNT && link_hint != current_bitrate_hint)
         {
-            if (++attempts >= 3)
+            link_ceiling = link_hint - 1;
+            link_hint = BITRATE_HINT_COUNT;
+
+            current_interface.initialize_tx(current_bitrate_hint);
+            _epro_select_rtt(current_bitrate_hint);
+
+            if (epro_wait_ms(_EPRO_LINK_FALLBACK_DELAY) == RESULT_ABORTED)
+            {
+                result = RESULT_ABORTED;
                 break;
+            }
 
-            result = _epro_send_packet(&packets[i]);
-            _delay_ms(2);
+            continue;
         }
 
-        if (result != RESULT_SUCCESS)
-            break;
+        break;
     }
-    current_interface.shutdown();
+#else
+    result = _epro_send_packets(message, num_packets, &acknowledged);
+#endif
+    _epro_shutdown_interface();
 
-    free(packets);
     return result;
 }
 
@@ -418,68 +625,262 @@ result_t epro_read_message(message_t *message)
 {
     result_t result = RESULT_FAILED;
 
-    packet_t *packets = 0;
-    uint8_t packet_count = 0;
-    uint8_t packet_index = 0;
+    // Blocks are allocated once the message header has arrived
+    message->blocks = 0;
 
-    packet_t packet;
+#if EPRO_TRANSPORT_RESUME_ENABLED
+    // Reassembled in place of a failed earlier attempt, the sender resumes where it broke off
+    message_t *target = &partial_message;
+    message_assembly_t *assembly = &partial_assembly;
+#else
+    message_t *target = message;
+    message_assembly_t local_assembly;
+    message_assembly_t *assembly = &local_assembly;
+    message_assembly_init(assembly);
+#endif
+
+    _epro_initialize_interface(_EPRO_SESSION_RX);
+#if EPRO_LINK_TRAINING_ENABLED
+    while (1)
+    {
+        // A negotiated rate is kept for the session, at the base rate every
+        // message is preceded by link training or a commit
+        result = RESULT_SUCCESS;
+        if (link_hint == BITRATE_HINT_COUNT || link_hint == current_bitrate_hint)
+            result = _epro_accept_link();
+
+        // Errors at a negotiated rate are detected by timeouts
+        if (result == RESULT_SUCCESS)
+            result = _epro_read_packets(target, assembly, (link_hint != current_bitrate_hint) ? EPRO_RX_PACKET_TIMEOUT : 0);
+
+        // The sender retrains at the base rate & resumes where it broke off
+        if (result != RESULT_SUCCESS && result != RESULT_ABORTED && link_hint != current_bitrate_hint)
+        {
+            link_hint = BITRATE_HINT_COUNT;
+            current_interface.initialize_rx(current_bitrate_hint);
+            _epro_select_rtt(current_bitrate_hint);
+            continue;
+        }
+
+        break;
+    }
+#else
+    result = _epro_read_packets(target, assembly, 0);
+#endif
+    _epro_shutdown_interface();
 
-    bool done = false;
+#if EPRO_TRANSPORT_RESUME_ENABLED
+    if (result == RESULT_SUCCESS)
+    {
+        *message = partial_message;
+        partial_message.blocks = 0;
+        message_assembly_free(assembly);
+    }
+#else
+    if (result != RESULT_SUCCESS)
+    {
+        message_free(message);
+        message->blocks = 0;
+    }
+
+    message_assembly_free(assembly);
+#endif
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+    if (result == RESULT_SUCCESS)
+        _epro_cache_message(message);
+#endif
+
+    return result;
+}
+
+
+#if EPRO_STREAM_COUNT > 1
+result_t epro_send_streams(const message_t *const *messages, uint8_t count)
+{
+    result_t result = RESULT_SUCCESS;
+
+    if (count == 0 || count > EPRO_STREAM_COUNT)
+        return RESULT_ERROR;
 
-    current_interface.initialize_rx(current_bitrate_hint);
-    while (!done)
+    uint16_t num_packets[EPRO_STREAM_COUNT];
+    uint16_t max_packets = 0;
+    for (uint8_t s = 0; s < count; ++s)
     {
-        uint8_t attempts = 0;
-        result = RESULT_FAILED;
-        while (result == RESULT_FAILED)
+        num_packets[s] = message_get_packet_count(messages[s]);
+        if (num_packets[s] == 0)
+            return RESULT_ERROR;
+
+        if (num_packets[s] > max_packets)
+            max_packets = num_packets[s];
+    }
+
+    _epro_initialize_interface(_EPRO_SESSION_TX);
+
+    // One packet per stream & turn, short messages are complete after a few turns
+    // instead of waiting behind long ones
+    packet_t packet;
+    for (uint16_t i = 0; i < max_packets && result == RESULT_SUCCESS; ++i)
+    {
+        for (uint8_t s = 0; s < count && result == RESULT_SUCCESS; ++s)
         {
-            if (++attempts >= 3)
-                break;
+            if (i >= num_packets[s])
+                continue;
+
+            message_get_packet(messages[s], i + 1, &packet);
+            packet.stream = s;
 
-            result = _epro_read_packet(&packet);
+            result = _epro_transfer_packet(&packet);
         }
+    }
+
+    _epro_shutdown_interface();
+
+    return result;
+}
+
+
+result_t epro_read_stream(message_t *message, uint8_t *stream)
+{
+    result_t result = RESULT_FAILED;
+
+    message->blocks = 0;
+
+    _epro_initialize_interface(_EPRO_SESSION_RX);
+
+    packet_t packet;
+    while (1)
+    {
+        // Give up on a sender that stops in the middle of a message
+        bool started = false;
+        for (uint8_t s = 0; s < EPRO_STREAM_COUNT; ++s)
+            started |= (streams[s].assembly.received != 0);
+
+        result = _epro_read_packet(&packet, started ? EPRO_RX_PACKET_TIMEOUT : 0);
+
+        // Corrupted packets are repeated by the sender, frames cut short are dropped
+        if (result == RESULT_FAILED || (result == RESULT_TIMEOUT && !started))
+            continue;
 
         if (result != RESULT_SUCCESS)
             break;
 
-        uint8_t index = packet_get_index(&packet);
-        uint8_t total = packet_get_total(&packet);
+        if (packet_get_index(&packet) == 0 || packet.stream >= EPRO_STREAM_COUNT)
+            continue;
 
-        if (index == 1)
+        _epro_stream_t *context = &streams[packet.stream];
+        if (!message_add_packet(&context->message, &context->assembly, &packet))
         {
-            if (packets)
-                free(packets);
-
-            packet_index = 0;
-            packet_count = total;
-            packets = malloc(packet_count * sizeof(packet_t));
+            result = RESULT_ERROR;
+            break;
         }
 
-        if (packets)
+        if (context->assembly.packets_received == context->assembly.packet_count)
         {
-            memcpy(&packets[packet_index++], &packet, sizeof(packet_t));
-            if (packet_index != index)
-            {
-                result = RESULT_FAILED;
-                done = true;
-            }
-            else if (packet_index >= packet_count)
-            {
-                result = RESULT_SUCCESS;
-                done = true;
-            }
+            result = message_is_complete(&context->message, &context->assembly) ? RESULT_SUCCESS
+                                                                                 : RESULT_FAILED;
+
+            // Hand over the message, the stream starts over with the next one
+            if (result == RESULT_SUCCESS)
+                *message = context->message;
+            else
+                message_free(&context->message);
+
+            context->message.blocks = 0;
+            message_assembly_free(&context->assembly);
+
+            *stream = packet.stream;
+            break;
         }
     }
-    current_interface.shutdown();
 
-    if (result == RESULT_SUCCESS)
-        message_from_packets(message, packets, packet_count);
+    // Partial messages are worthless once the sender is gone
+    if (result != RESULT_SUCCESS && result != RESULT_FAILED)
+        _epro_free_streams();
+
+    _epro_shutdown_interface();
 
-    if (packets)
-        free(packets);
+    return result;
+}
+#endif
+
+
+#if EPRO_FULL_DUPLEX_ENABLED
+result_t epro_exchange_messages(const message_t *tx_message, message_t *rx_message)
+{
+    result_t result = RESULT_FAILED;
+
+    uint16_t num_packets = message_get_packet_count(tx_message);
+    if (num_packets == 0 || !current_interface.post_packet)
+        return RESULT_ERROR;
+
+    rx_message->blocks = 0;
+
+    message_assembly_t assembly;
+    message_assembly_init(&assembly);
+
+    _epro_initialize_interface(_EPRO_SESSION_TX);
+    result = _epro_exchange_packets(tx_message, num_packets, rx_message, &assembly);
+    _epro_shutdown_interface();
+
+    if (result != RESULT_SUCCESS)
+    {
+        message_free(rx_message);
+        rx_message->blocks = 0;
+    }
+
+    message_assembly_free(&assembly);
 
     return result;
 }
+#endif
+
+
+result_t epro_open_tx_session()
+{
+    _epro_initialize_interface(_EPRO_SESSION_TX);
+    current_session = _EPRO_SESSION_TX;
+
+#if EPRO_LINK_TRAINING_ENABLED
+    // Negotiated once, the messages of the session use the same rate. If
+    // nobody answers, the first message tries again.
+    if (link_hint == BITRATE_HINT_COUNT)
+        return _epro_train_link();
+#endif
+
+    return RESULT_SUCCESS;
+}
+
+
+void epro_open_rx_session()
+{
+    _epro_initialize_interface(_EPRO_SESSION_RX);
+    current_session = _EPRO_SESSION_RX;
+}
+
+
+void epro_close_session()
+{
+    if (current_session == _EPRO_SESSION_NONE)
+        return;
+
+    current_session = _EPRO_SESSION_NONE;
+    current_interface.shutdown();
+
+#if EPRO_TRANSPORT_RESUME_ENABLED
+    message_assembly_free(&partial_assembly);
+    message_free(&partial_message);
+    partial_message.blocks = 0;
+#endif
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+    _epro_free_cache();
+#endif
+
+#if EPRO_STREAM_COUNT > 1
+    _epro_free_streams();
+#endif
+}
 
 
 void _epro_initialize_lcd()
@@ -522,21 +923,63 @@ void _epro_initialize_keys()
 }
 
 
-result_t _epro_send_packet(const packet_t *packet)
+void _epro_initialize_interface(_epro_session_t direction)
+{
+    // Already kept open by a session
+    if (current_session == direction)
+        return;
+
+    // A session in the opposite direction has to be closed first
+    epro_close_session();
+    _epro_select_rtt(current_bitrate_hint);
+
+#if EPRO_LINK_TRAINING_ENABLED
+    link_hint = BITRATE_HINT_COUNT;
+#endif
+
+    if (direction == _EPRO_SESSION_TX)
+        current_interface.initialize_tx(current_bitrate_hint);
+    else
+        current_interface.initialize_rx(current_bitrate_hint);
+}
+
+
+void _epro_shutdown_interface()
+{
+    // Sessions are shut down by epro_close_session()
+    if (current_session == _EPRO_SESSION_NONE)
+        current_interface.shutdown();
+}
+
+
+result_t _epro_wait_for_interface(uint16_t timeout)
 {
     // Start timer
     timer_t timer;
     timer_start(&timer);
 
+    uint16_t start = 0;
+    current_interface.status->active = false;
+
     result_t result = RESULT_SUCCESS;
 
-    current_interface.send_packet(packet);
     while (!current_interface.status->done)
     {
+        if (current_interface.process)
+            current_interface.process();
+
+        // Once bytes are coming in, only the gap between them is limited
+        if (current_interface.status->active)
+        {
+            current_interface.status->active = false;
+            start = timer.msecs;
+            timeout = EPRO_RX_BYTE_TIMEOUT;
+        }
+
         epro_poll_keys();
         if (epro_is_key_pressed(KEY_BACK))
             result = RESULT_ABORTED;
-        else if (timer.msecs > 1000)
+        else if (timeout > 0 && (uint16_t)(timer.msecs - start) > timeout)
             result = RESULT_TIMEOUT;
 
         if (result != RESULT_SUCCESS)
@@ -549,23 +992,862 @@ result_t _epro_send_packet(const packet_t *packet)
     result = current_interface.status->result;
 
 done:
+    wait_time = timer.msecs;
     timer_stop(&timer);
     return result;
 }
 
 
-result_t _epro_read_packet(packet_t *packet)
+void _epro_select_rtt(bitrate_hint_t hint)
 {
-    current_interface.read_packet(packet);
-    while (!current_interface.status->done)
+    // Keep the estimate as long as the link stays the same
+    if (rtt.hint == hint)
+        return;
+
+    rtt.hint = hint;
+    rtt.valid = false;
+    rtt.rto = EPRO_TRANSPORT_MAX_RTO;
+}
+
+
+void _epro_update_rtt(uint16_t sample)
+{
+    if (sample > EPRO_TRANSPORT_MAX_RTO)
+        sample = EPRO_TRANSPORT_MAX_RTO;
+
+    if (!rtt.valid)
     {
-        epro_poll_keys();
-        if (epro_is_key_pressed(KEY_BACK))
-        {
-            current_interface.abort();
-            return RESULT_ABORTED;
-        }
+        // First measurement, rttvar = sample/2
+        rtt.srtt = sample << 3;
+        rtt.rttvar = sample << 1;
+        rtt.valid = true;
+    }
+    else
+    {
+        // srtt += (sample - srtt)/8, rttvar += (|sample - srtt| - rttvar)/4
+        int16_t delta = (int16_t)sample - (int16_t)(rtt.srtt >> 3);
+        rtt.srtt += delta;
+
+        if (delta < 0)
+            delta = -delta;
+
+        rtt.rttvar += delta - (rtt.rttvar >> 2);
     }
 
-    return current_interface.status->result;
+    // rto = srtt + 4*rttvar, the timer ticks once per ms
+    uint16_t rto = (rtt.srtt >> 3) + (rtt.rttvar > 1 ? rtt.rttvar : 1);
+    if (rto < EPRO_TRANSPORT_MIN_RTO)
+        rto = EPRO_TRANSPORT_MIN_RTO;
+    else if (rto > EPRO_TRANSPORT_MAX_RTO)
+        rto = EPRO_TRANSPORT_MAX_RTO;
+
+    rtt.rto = rto;
+}
+
+
+void _epro_backoff_rtt()
+{
+    uint32_t rto = (uint32_t)rtt.rto * EPRO_TRANSPORT_RTO_BACKOFF;
+    rtt.rto = (rto > EPRO_TRANSPORT_MAX_RTO) ? EPRO_TRANSPORT_MAX_RTO : rto;
+}
+
+
+result_t _epro_send_packet(const packet_t *packet)
+{
+    current_interface.send_packet(packet, true);
+    return _epro_wait_for_interface(rtt.rto);
+}
+
+
+result_t _epro_read_packet(packet_t *packet, uint16_t timeout)
+{
+    current_interface.read_packet(packet, true);
+    return _epro_wait_for_interface(timeout);
 }
+
+
+result_t _epro_send_packets(const message_t *message, uint16_t num_packets, uint16_t *acknowledged)
+{
+#if EPRO_TRANSPORT_WINDOW_SIZE > 1
+    return _epro_send_packets_windowed(message, num_packets, acknowledged);
+#else
+    result_t result = RESULT_SUCCESS;
+
+    packet_t packet;
+    while (*acknowledged < num_packets)
+    {
+        message_get_packet(message, *acknowledged + 1, &packet);
+
+        result = _epro_transfer_packet(&packet);
+        if (result != RESULT_SUCCESS)
+            break;
+
+        ++(*acknowledged);
+    }
+
+    return result;
+#endif
+}
+
+
+#if EPRO_TRANSPORT_WINDOW_SIZE <= 1
+result_t _epro_transfer_packet(const packet_t *packet)
+{
+    result_t result = RESULT_FAILED;
+
+    uint8_t attempts = 0;
+    while (result == RESULT_FAILED || result == RESULT_TIMEOUT)
+    {
+        if (++attempts > EPRO_TRANSPORT_MAX_ATTEMPTS)
+            break;
+
+        result = _epro_send_packet(packet);
+
+        // Only unambiguous round trips are measured, retransmissions are not
+        if (result == RESULT_SUCCESS && attempts == 1)
+            _epro_update_rtt(wait_time);
+        else if (result == RESULT_TIMEOUT)
+            _epro_backoff_rtt();
+    }
+
+    return result;
+}
+#endif
+
+
+result_t _epro_read_packets(message_t *message, message_assembly_t *assembly, uint16_t timeout)
+{
+#if EPRO_TRANSPORT_WINDOW_SIZE > 1
+    return _epro_read_packets_windowed(message, assembly, timeout);
+#else
+    result_t result = RESULT_FAILED;
+
+    packet_t packet;
+
+    while (1)
+    {
+        // Give up on a sender that stops in the middle of a message
+        uint16_t packet_timeout = assembly->received ? EPRO_RX_PACKET_TIMEOUT : timeout;
+
+        uint8_t attempts = 0;
+        result = RESULT_FAILED;
+        while (result == RESULT_FAILED)
+        {
+            if (++attempts >= 3)
+                break;
+
+            result = _epro_read_packet(&packet, packet_timeout);
+        }
+
+        // A frame cut short before the message started is dropped, keep hunting
+        if (result == RESULT_TIMEOUT && !assembly->received && timeout == 0)
+            continue;
+
+        if (result != RESULT_SUCCESS)
+            break;
+
+        // Link control packets & other streams are not part of the message
+        if (packet_get_index(&packet) == 0 || packet.stream != 0)
+            continue;
+
+        // A lost acknowledgement makes the sender repeat a packet, the driver
+        // has acknowledged it again and the duplicate is dropped here
+        if (!message_add_packet(message, assembly, &packet))
+        {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        if (assembly->packets_received == assembly->packet_count)
+        {
+            result = message_is_complete(message, assembly) ? RESULT_SUCCESS : RESULT_FAILED;
+            break;
+        }
+    }
+
+    return result;
+#endif
+}
+
+
+#if EPRO_TRANSPORT_WINDOW_SIZE > 1
+result_t _epro_send_packets_windowed(const message_t *message, uint16_t num_packets, uint16_t *acknowledged)
+{
+    result_t result = RESULT_FAILED;
+
+#if !EPRO_TRANSPORT_SELECTIVE_REPEAT
+    packet_t packet;
+#endif
+
+    // Index of first unacknowledged packet
+    uint16_t base = *acknowledged;
+
+    // Packets the receiver can take before the next poll, unknown until it answers
+    uint8_t credit = 1;
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+    // Last acknowledgement received, nothing has arrived yet
+    packet_ack_t missing;
+    packet_ack_init(&missing, ASCII_NACK, 1, 1);
+    for (uint8_t i = 0; i < EPRO_TRANSPORT_WINDOW_SIZE; ++i)
+    {
+        packet_ack_set_missing(&missing, i);
+
+        // Nothing buffered belongs to this message
+        tx_window[i].index = 0;
+    }
+#endif
+
+#if _EPRO_ANNOUNCE_ENABLED
+    // Continue where the receiver broke off, if it holds part or all of this message
+    packet_ack_t announce_ack;
+    result = _epro_announce_message(message, num_packets, &announce_ack);
+    if (result != RESULT_SUCCESS)
+        return result;
+
+    base = announce_ack.index - 1;
+    if (announce_ack.credit > 0)
+        credit = announce_ack.credit;
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+    missing = announce_ack;
+#endif
+#endif
+
+    uint8_t attempts = 0;
+    while (base < num_packets)
+    {
+        if (++attempts > EPRO_TRANSPORT_MAX_ATTEMPTS)
+            break;
+
+#if EPRO_TRANSPORT_BURST_ENABLED
+        // The window spans the rest of the message
+        uint16_t end = num_packets;
+#else
+        uint16_t end = base + EPRO_TRANSPORT_WINDOW_SIZE;
+        if (end > num_packets)
+            end = num_packets;
+#endif
+
+        // Send the whole window without waiting for acknowledgements, but
+        // never more packets than the receiver has room for
+        uint8_t sent = 0;
+        for (uint16_t i = base; i < end && sent < credit; ++i)
+        {
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+            // Only repeat packets the receiver reported missing
+            if (!packet_ack_is_missing(&missing, i - base))
+                continue;
+#endif
+
+            sent++;
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+            current_interface.send_packet(_epro_get_window_packet(message, i + 1), false);
+#else
+            // Regenerated on every attempt, drivers encode right away
+            message_get_packet(message, i + 1, &packet);
+            current_interface.send_packet(&packet, false);
+#endif
+            result = _epro_wait_for_interface(EPRO_TX_FRAME_TIMEOUT);
+            if (result != RESULT_SUCCESS)
+                break;
+        }
+
+        packet_ack_t ack;
+        if (result == RESULT_SUCCESS)
+        {
+            current_interface.read_ack(&ack);
+            result = _epro_wait_for_interface(rtt.rto);
+
+            // Every poll is answered on its own, so each one is a clean sample
+            if (result == RESULT_SUCCESS)
+                _epro_update_rtt(wait_time);
+            else if (result == RESULT_TIMEOUT)
+                _epro_backoff_rtt();
+        }
+
+        if (result == RESULT_ABORTED)
+            break;
+
+        // Go back to first unacknowledged packet on timeout or corrupted acknowledgement
+        if (result != RESULT_SUCCESS)
+            continue;
+
+        if (ack.credit > 0)
+            credit = ack.credit;
+
+        // Acknowledgements are cumulative, ack.index is the next packet expected
+        uint16_t acknowledged = ack.index - 1;
+        if (acknowledged > base && acknowledged <= num_packets)
+        {
+            base = acknowledged;
+            attempts = 0;
+        }
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+        if (acknowledged == base)
+            missing = ack;
+#endif
+
+        result = RESULT_FAILED;
+    }
+
+    if (base >= num_packets)
+        result = RESULT_SUCCESS;
+
+    *acknowledged = base;
+
+    return result;
+}
+
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+const packet_t *_epro_get_window_packet(const message_t *message, uint16_t index)
+{
+    // Built once, reused for every repeat while the packet stays in the window
+    packet_t *packet = &tx_window[(index - 1) % EPRO_TRANSPORT_WINDOW_SIZE];
+    if (packet_get_index(packet) != index)
+        message_get_packet(message, index, packet);
+
+    return packet;
+}
+#endif
+
+
+result_t _epro_read_packets_windowed(message_t *message, message_assembly_t *assembly, uint16_t timeout)
+{
+    result_t result = RESULT_FAILED;
+
+    packet_t packet;
+
+    bool packet_lost = false;
+
+    // Set once the sender has started on this message
+    bool started = false;
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+    // Packet count of the announced message if it was found in the cache
+    uint16_t cached_count = 0;
+#endif
+
+    while (1)
+    {
+        // Give up on a sender that stops in the middle of a message
+        uint16_t packet_timeout = started ? EPRO_RX_PACKET_TIMEOUT : timeout;
+
+        current_interface.read_packet(&packet, false);
+        result = _epro_wait_for_interface(packet_timeout);
+
+        // A frame cut short before the message started is dropped, keep hunting
+        if (result == RESULT_TIMEOUT && !started && timeout == 0)
+            continue;
+
+        if (result == RESULT_ABORTED || result == RESULT_TIMEOUT)
+            break;
+
+        if (current_interface.status->ack_requested)
+        {
+            // Acknowledge everything up to the first hole
+            packet_ack_t ack;
+#if _EPRO_ANNOUNCE_ENABLED
+            // Index 0 asks the sender to announce the message first
+            uint16_t first_missing = started ? message_get_missing_packet(assembly) : 0;
+#else
+            uint16_t first_missing = message_get_missing_packet(assembly);
+#endif
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+            // Nothing is missing, the sender skips all packets
+            if (cached_count > 0)
+                first_missing = cached_count + 1;
+#endif
+            packet_ack_init(&ack, packet_lost ? ASCII_NACK : ASCII_ACK, first_missing, _EPRO_RX_CREDIT);
+            packet_lost = false;
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+            // Report holes beyond the first one as well, the sender repeats only those
+            for (uint8_t i = 0; i < EPRO_TRANSPORT_WINDOW_SIZE; ++i)
+            {
+                if (!message_has_packet(assembly, first_missing + i))
+                    packet_ack_set_missing(&ack, i);
+            }
+#endif
+
+            current_interface.send_ack(&ack);
+            result = _epro_wait_for_interface(EPRO_TX_FRAME_TIMEOUT);
+            if (result == RESULT_ABORTED)
+                break;
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+            if (cached_count > 0)
+            {
+                result = RESULT_SUCCESS;
+                break;
+            }
+#endif
+
+            if (assembly->packet_count > 0 && assembly->packets_received == assembly->packet_count)
+            {
+                result = message_is_complete(message, assembly) ? RESULT_SUCCESS : RESULT_FAILED;
+                break;
+            }
+
+            continue;
+        }
+
+        if (result != RESULT_SUCCESS)
+        {
+            packet_lost = true;
+            continue;
+        }
+
+        uint16_t index = packet_get_index(&packet);
+        if (index == 0)
+        {
+#if _EPRO_ANNOUNCE_ENABLED
+            if (packet.data[0] == _EPRO_MESSAGE_ANNOUNCE)
+            {
+                uint32_t digest = packet.data[1] | ((uint32_t)packet.data[2] << 8) |
+                                  ((uint32_t)packet.data[3] << 16) | ((uint32_t)packet.data[4] << 24);
+
+                // Keep what was received of the same message, start over otherwise
+                if (digest != announced_digest || assembly->packet_count != packet_get_total(&packet))
+                {
+                    message_assembly_free(assembly);
+                    message_free(message);
+                    message->blocks = 0;
+                    announced_digest = digest;
+                }
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+                if (_epro_find_cached_message(digest, packet_get_total(&packet), message))
+                {
+                    message_assembly_free(assembly);
+                    cached_count = packet_get_total(&packet);
+                }
+#endif
+
+                started = true;
+            }
+#endif
+            continue;
+        }
+
+#if _EPRO_ANNOUNCE_ENABLED
+        // Packets can't be assigned to a message before it was announced
+        if (!started)
+            continue;
+#endif
+
+        // Packets beyond a hole are kept, the hole is reported with the next acknowledgement
+        if (index > message_get_missing_packet(assembly))
+            packet_lost = true;
+
+        // Duplicates & stray packets are dropped silently
+        if (!message_add_packet(message, assembly, &packet))
+        {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        if (assembly->received)
+            started = true;
+    }
+
+    return result;
+}
+#endif // EPRO_TRANSPORT_WINDOW_SIZE > 1
+
+
+#if EPRO_FULL_DUPLEX_ENABLED
+result_t _epro_exchange_packets(const message_t *tx_message, uint16_t num_packets,
+                                message_t *rx_message, message_assembly_t *assembly)
+{
+    result_t result = RESULT_SUCCESS;
+
+    // Stop-and-wait in both directions, each packet acknowledges the other
+    // end's by the index expected next. Both count from 1.
+    uint16_t next = 1;
+    uint16_t expected = 1;
+
+    bool in_flight = false;
+    bool ack_due = false;
+    bool contact = false;
+    uint8_t attempts = 0;
+
+    timer_t timer;
+    timer_start(&timer);
+
+    uint16_t sent_at = 0;
+    uint16_t heard_at = 0;
+
+    packet_t packet;
+    while (1)
+    {
+        if (current_interface.process)
+            current_interface.process();
+
+        epro_poll_keys();
+        if (epro_is_key_pressed(KEY_BACK))
+        {
+            result = RESULT_ABORTED;
+            break;
+        }
+
+        uint16_t now = timer.msecs;
+
+        if (current_interface.fetch_packet(&packet))
+        {
+            // Transmissions while waiting for the other end to start don't count
+            if (!contact)
+            {
+                contact = true;
+                attempts = 0;
+            }
+
+            heard_at = now;
+
+            if (next <= num_packets && packet.ack == next + 1)
+            {
+                // Only unambiguous round trips are measured
+                if (in_flight && attempts == 1)
+                    _epro_update_rtt(now - sent_at);
+
+                ++next;
+                in_flight = false;
+                attempts = 0;
+            }
+
+            // Index 0 is a bare acknowledgement. Duplicates are acknowledged
+            // again, the last acknowledgement may have been lost.
+            if (packet_get_index(&packet) != 0 && packet.stream == 0)
+            {
+                if (packet_get_index(&packet) == expected)
+                {
+                    if (!message_add_packet(rx_message, assembly, &packet))
+                    {
+                        result = RESULT_ERROR;
+                        break;
+                    }
+
+                    // A stray packet is dropped & not acknowledged
+                    if (message_has_packet(assembly, expected))
+                        ++expected;
+                }
+
+                ack_due = true;
+            }
+        }
+
+        bool done = (next > num_packets && assembly->packet_count > 0
+                     && assembly->packets_received == assembly->packet_count);
+
+        if (done && !ack_due)
+        {
+            // Linger while the other end might repeat its last packet
+            if ((uint16_t)(now - heard_at) > 2*rtt.rto)
+            {
+                result = message_is_complete(rx_message, assembly) ? RESULT_SUCCESS : RESULT_FAILED;
+                break;
+            }
+        }
+        else if (contact && (uint16_t)(now - heard_at) > EPRO_RX_PACKET_TIMEOUT)
+        {
+            result = RESULT_TIMEOUT;
+            break;
+        }
+        else if (!contact && EPRO_EXCHANGE_TIMEOUT > 0 && now > EPRO_EXCHANGE_TIMEOUT)
+        {
+            // Nobody started an exchange at the other end
+            result = RESULT_TIMEOUT;
+            break;
+        }
+
+        if (in_flight && (uint16_t)(now - sent_at) > rtt.rto)
+        {
+            if (contact && attempts >= EPRO_TRANSPORT_MAX_ATTEMPTS)
+            {
+                result = RESULT_FAILED;
+                break;
+            }
+
+            _epro_backoff_rtt();
+            in_flight = false;
+        }
+
+        // Acknowledgements ride on the next packet, if there is one
+        if (!in_flight && next <= num_packets)
+        {
+            message_get_packet(tx_message, next, &packet);
+            packet.ack = expected;
+
+            if (current_interface.post_packet(&packet))
+            {
+                in_flight = true;
+                ack_due = false;
+                sent_at = now;
+                ++attempts;
+            }
+        }
+        else if (ack_due)
+        {
+            packet_init(&packet, 0, 0, packet.data, 0);
+            packet.ack = expected;
+
+            if (current_interface.post_packet(&packet))
+                ack_due = false;
+        }
+    }
+
+    timer_stop(&timer);
+
+    return result;
+}
+#endif
+
+
+#if _EPRO_ANNOUNCE_ENABLED
+result_t _epro_announce_message(const message_t *message, uint16_t num_packets, packet_ack_t *ack)
+{
+    result_t result = RESULT_FAILED;
+
+    uint32_t digest = message_get_digest(message);
+    const uint8_t data[EPRO_BLOCK_LENGTH] = { _EPRO_MESSAGE_ANNOUNCE, digest & 0xff, (digest >> 8) & 0xff,
+                                              (digest >> 16) & 0xff, digest >> 24 };
+
+    packet_t packet;
+    packet_init(&packet, 0, num_packets, data, EPRO_BLOCK_LENGTH);
+
+    for (uint8_t attempts = 0; attempts < EPRO_TRANSPORT_MAX_ATTEMPTS; ++attempts)
+    {
+        current_interface.send_packet(&packet, false);
+        result = _epro_wait_for_interface(EPRO_TX_FRAME_TIMEOUT);
+        if (result == RESULT_ABORTED)
+            return result;
+
+        if (result != RESULT_SUCCESS)
+            continue;
+
+        current_interface.read_ack(ack);
+        result = _epro_wait_for_interface(rtt.rto);
+        if (result == RESULT_SUCCESS)
+            _epro_update_rtt(wait_time);
+        else if (result == RESULT_TIMEOUT)
+            _epro_backoff_rtt();
+
+        if (result == RESULT_ABORTED)
+            return result;
+
+        // The receiver answers with the first packet it is missing
+        if (result == RESULT_SUCCESS && ack->index >= 1 && ack->index <= num_packets + 1)
+            return RESULT_SUCCESS;
+
+        result = RESULT_FAILED;
+    }
+
+    return result;
+}
+#endif
+
+
+#if EPRO_LINK_TRAINING_ENABLED
+result_t _epro_train_link()
+{
+    result_t result = RESULT_FAILED;
+
+    // Probe the fastest rate first, hints are ordered by bitrate
+    bitrate_hint_t hint = link_ceiling;
+    for (; hint > current_bitrate_hint; --hint)
+    {
+        // Propose new rate at base rate. If no receiver takes the proposal
+        // there is nothing to say about the rate, link_hint stays unset.
+        current_interface.initialize_tx(current_bitrate_hint);
+        result = _epro_send_link_packet(_EPRO_LINK_PROPOSE, hint, EPRO_TRANSPORT_MAX_RTO,
+                                        EPRO_TRANSPORT_MAX_ATTEMPTS);
+        if (result != RESULT_SUCCESS)
+            return result;
+
+        // Give receiver some time to switch
+        current_interface.initialize_tx(hint);
+        _delay_ms(30);
+
+        uint8_t errors = 0;
+        for (uint8_t i = 0; i < EPRO_LINK_PROBE_COUNT && errors <= EPRO_LINK_MAX_PROBE_ERRORS; ++i)
+        {
+            result = _epro_send_link_packet(_EPRO_LINK_PROBE, hint, EPRO_LINK_TIMEOUT, 1);
+            if (result == RESULT_ABORTED)
+                return result;
+            else if (result != RESULT_SUCCESS)
+                errors++;
+        }
+
+        if (errors <= EPRO_LINK_MAX_PROBE_ERRORS)
+        {
+            result = _epro_send_link_packet(_EPRO_LINK_COMMIT, hint, EPRO_LINK_TIMEOUT, 1);
+            if (result == RESULT_SUCCESS || result == RESULT_ABORTED)
+                break;
+        }
+
+        // Stay silent until the receiver falls back to the base rate
+        current_interface.initialize_tx(current_bitrate_hint);
+        if (epro_wait_ms(2*EPRO_LINK_TIMEOUT) == RESULT_ABORTED)
+            return RESULT_ABORTED;
+    }
+
+    // No faster rate is usable, settle on the base rate
+    if (hint <= current_bitrate_hint)
+    {
+        hint = current_bitrate_hint;
+        current_interface.initialize_tx(hint);
+        result = _epro_send_link_packet(_EPRO_LINK_COMMIT, hint, EPRO_TRANSPORT_MAX_RTO,
+                                        EPRO_TRANSPORT_MAX_ATTEMPTS);
+    }
+
+    if (result == RESULT_SUCCESS)
+    {
+        link_hint = hint;
+        _epro_select_rtt(hint);
+    }
+
+    return result;
+}
+
+
+result_t _epro_accept_link()
+{
+    result_t result = RESULT_FAILED;
+
+    packet_t packet;
+    bitrate_hint_t hint = current_bitrate_hint;
+
+    while (1)
+    {
+        // Wait forever at the base rate only
+        result = _epro_read_packet(&packet, (hint != current_bitrate_hint) ? EPRO_LINK_TIMEOUT : 0);
+        if (result == RESULT_ABORTED)
+            return result;
+
+        // Sender gave up on the proposed rate
+        if (result == RESULT_TIMEOUT)
+        {
+            hint = current_bitrate_hint;
+            current_interface.initialize_rx(hint);
+            continue;
+        }
+
+        if (result != RESULT_SUCCESS || packet_get_index(&packet) != 0 || packet.data[1] >= BITRATE_HINT_COUNT)
+            continue;
+
+        if (packet.data[0] == _EPRO_LINK_PROPOSE)
+        {
+            // The driver has sent the acknowledgement by now, the UART drains
+            // its transmitter before changing the rate
+            hint = packet.data[1];
+            current_interface.initialize_rx(hint);
+        }
+        else if (packet.data[0] == _EPRO_LINK_COMMIT)
+        {
+            link_hint = hint;
+            _epro_select_rtt(hint);
+            return RESULT_SUCCESS;
+        }
+    }
+}
+
+
+result_t _epro_send_link_packet(_epro_link_t type, bitrate_hint_t hint, uint16_t timeout, uint8_t attempts)
+{
+    result_t result = RESULT_FAILED;
+
+    // Test pattern covering idle levels & alternating bits
+    const uint8_t data[EPRO_BLOCK_LENGTH] = { type, hint, 0x55, 0xaa, 0x00, 0xff, 0x0f, 0xf0 };
+
+    packet_t packet;
+    packet_init(&packet, 0, 0, data, EPRO_BLOCK_LENGTH);
+
+    while (attempts-- > 0)
+    {
+        current_interface.send_packet(&packet, true);
+        result = _epro_wait_for_interface(timeout);
+        if (result == RESULT_SUCCESS || result == RESULT_ABORTED)
+            break;
+    }
+
+    return result;
+}
+#endif // EPRO_LINK_TRAINING_ENABLED
+
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0
+void _epro_cache_message(const message_t *message)
+{
+    uint32_t digest = message_get_digest(message);
+    uint16_t packet_count = message_get_packet_count(message);
+
+    for (uint8_t i = 0; i < EPRO_MESSAGE_CACHE_SIZE; ++i)
+    {
+        if (cache[i].packet_count == packet_count && cache[i].digest == digest)
+            return;
+    }
+
+    _epro_cache_entry_t *entry = &cache[cache_next];
+    cache_next = (cache_next + 1) % EPRO_MESSAGE_CACHE_SIZE;
+
+    message_free(&entry->message);
+    entry->message.blocks = 0;
+    entry->packet_count = 0;
+
+    if (message_copy(&entry->message, message))
+    {
+        entry->digest = digest;
+        entry->packet_count = packet_count;
+    }
+}
+
+
+bool _epro_find_cached_message(uint32_t digest, uint16_t packet_count, message_t *message)
+{
+    for (uint8_t i = 0; i < EPRO_MESSAGE_CACHE_SIZE; ++i)
+    {
+        if (cache[i].packet_count == 0 || cache[i].packet_count != packet_count || cache[i].digest != digest)
+            continue;
+
+        // Leave the message untouched if there is no memory for the copy
+        message_t copy;
+        if (!message_copy(&copy, &cache[i].message))
+            return false;
+
+        message_free(message);
+        *message = copy;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+void _epro_free_cache()
+{
+    for (uint8_t i = 0; i < EPRO_MESSAGE_CACHE_SIZE; ++i)
+    {
+        message_free(&cache[i].message);
+        cache[i].message.blocks = 0;
+        cache[i].packet_count = 0;
+    }
+
+    cache_next = 0;
+}
+#endif
+
+
+#if EPRO_STREAM_COUNT > 1
+void _epro_free_streams()
+{
+    for (uint8_t s = 0; s < EPRO_STREAM_COUNT; ++s)
+    {
+        message_assembly_free(&streams[s].assembly);
+        message_free(&streams[s].message);
+        streams[s].message.blocks = 0;
+    }
+}
+#endif
@@ -34,6 +34,9 @@ void epro_initialize(interface_t interface);
 void epro_select_interface(interface_t interface);
 void epro_set_bitrate_hint(bitrate_hint_t hint);
 bool epro_get_input(const char *caption, uint8_t *input, uint8_t length, bool digits_only);
+#if EPRO_RS232_MULTIDROP_ENABLED
+void epro_set_bus_addresses(uint8_t address, uint8_t peer);
+#endif
 
 // Timing
 void epro_delay_ms(uint16_t milliseconds);
@@ -54,4 +57,25 @@ result_t epro_read_packet(packet_t *packet);
 result_t epro_send_message(const message_t *message);
 result_t epro_read_message(message_t *message);
 
+#if EPRO_STREAM_COUNT > 1
+// Sends messages[i] on stream i, interleaving their packets
+result_t epro_send_streams(const message_t *const *messages, uint8_t count);
+
+// Returns the first message completed on any stream, the others keep
+// their partial messages until the next call
+result_t epro_read_stream(message_t *message, uint8_t *stream);
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED
+// Sends a message while reading the one the other end sends at the same
+// time, both ends call this. RS-232 only. Times out if the other end doesn't
+// answer within EPRO_EXCHANGE_TIMEOUT ms.
+result_t epro_exchange_messages(const message_t *tx_message, message_t *rx_message);
+#endif
+
+// Sessions, keep the interface initialized across several messages
+result_t epro_open_tx_session(void);
+void epro_open_rx_session(void);
+void epro_close_session(void);
+
 #endif // EPRO_H
@@ -26,6 +26,7 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include <string.h>
@@ -92,24 +93,51 @@ static const uint32_t bitrates[BITRATE_HINT_COUNT] =
 
 static volatile _i2c_mode_t mode = _I2C_MODE_IDLE;
 static volatile uint8_t ack = ASCII_NACK;
+static volatile bool immediate_ack = true;
 
-static uint8_t packet_buffer[sizeof(packet_t)];
-static uint8_t packet_buffer_position = 0;
+// Set while the master keeps the bus between burst frames
+static volatile bool bus_held = false;
+
+// Set by the interrupt handler when the slave needs time before the next
+// START, which _i2c_process() sends outside the handler
+static volatile bool start_pending = false;
+
+static packet_frame_t frame;
 
 static packet_t *current_packet = 0;
 
+static uint8_t ack_buffer[sizeof(packet_ack_t)];
+static uint8_t ack_buffer_position = 0;
+
+static packet_ack_t *current_ack = 0;
+
+#if PACKET_QUEUE_ENABLED
+static packet_queue_t queue;
+
+// Poll received while packets were queued, answered once they are handed over
+static volatile bool poll_pending = false;
+#endif
+
 static interface_status_t status;
 
+// Hints the TWI is currently configured for, BITRATE_HINT_COUNT if not
+static bitrate_hint_t tx_hint = BITRATE_HINT_COUNT;
+static bitrate_hint_t rx_hint = BITRATE_HINT_COUNT;
+
 
 // Driver functions
 static void _i2c_initialize_tx(bitrate_hint_t hint);
 static void _i2c_initialize_rx(bitrate_hint_t hint);
 static void _i2c_shutdown(void);
 
-static void _i2c_send_packet(const packet_t *packet);
-static void _i2c_read_packet(packet_t *packet);
+static void _i2c_send_packet(const packet_t *packet, bool immediate);
+static void _i2c_read_packet(packet_t *packet, bool immediate);
 static void _i2c_abort(void);
 
+static void _i2c_send_ack(const packet_ack_t *ack);
+static void _i2c_read_ack(packet_ack_t *ack);
+static void _i2c_process(void);
+
 // Private helper, masks out prescaler bits
 static uint8_t _i2c_read_status(void);
 
@@ -157,28 +185,64 @@ void i2c_alloc_interface(interface_driver_t *interface)
     interface->read_packet   = _i2c_read_packet;
     interface->abort         = _i2c_abort;
 
+    interface->send_ack      = _i2c_send_ack;
+    interface->read_ack      = _i2c_read_ack;
+    interface->process       = _i2c_process;
+#if EPRO_FULL_DUPLEX_ENABLED
+    interface->post_packet   = 0;
+    interface->fetch_packet  = 0;
+#endif
+
     interface->status        = &status;
 }
 
 
 void _i2c_initialize_tx(bitrate_hint_t hint)
 {
+    // Already configured, only reset transfer state
+    if (hint == tx_hint)
+    {
+        _i2c_abort();
+        return;
+    }
+
     // Disable internal pull-ups
     PORTC &= ~((1<<PC0) | (1<<PC1));
 
     // Set bitrate using 1/4 prescaler (see ATmega32 datasheet page 175)
     TWSR |= (1<<TWPS0);
     TWBR = ((float)F_CPU / (8*bitrates[hint])) - 2;
+
+    mode = _I2C_MODE_IDLE;
+    start_pending = false;
+    status.ack_requested = false;
+
+    tx_hint = hint;
+    rx_hint = BITRATE_HINT_COUNT;
 }
 
 
 void _i2c_initialize_rx(bitrate_hint_t hint)
 {
+    // Already configured, only reset transfer state
+    if (hint == rx_hint)
+    {
+        _i2c_abort();
+        return;
+    }
+
     // Disable internal pull-ups
     PORTC &= ~((1<<PC0) | (1<<PC1));
 
     // Place slave address to react on into slave address register
     TWAR = SLAVE_ADDRESS << 1; // Bits 7 to 1
+
+    mode = _I2C_MODE_IDLE;
+    start_pending = false;
+    status.ack_requested = false;
+
+    tx_hint = BITRATE_HINT_COUNT;
+    rx_hint = hint;
 }
 
 
@@ -186,30 +250,90 @@ void _i2c_shutdown()
 {
     // Disable TWI
     TWCR = 0x00;
+    bus_held = false;
+
+    tx_hint = BITRATE_HINT_COUNT;
+    rx_hint = BITRATE_HINT_COUNT;
 }
 
 
-void _i2c_send_packet(const packet_t *packet)
+void _i2c_send_packet(const packet_t *packet, bool immediate)
 {
-    // Initialize packet buffer
-    memcpy(packet_buffer, packet, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // Initialize frame buffer
+    packet_frame_encode(&frame, packet);
+    immediate_ack = immediate;
     mode = _I2C_MODE_PACKET_TX;
+    bus_held = false;
 
     status.result = RESULT_FAILED;
     status.done = false;
 
-    // Enable interrupt & send START
+    // Wait for STOP of previous packet to complete
+    while (TWCR & (1<<TWSTO))
+        ;
+
+    // Enable interrupt & send START, a repeated START if the bus is still held
     TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWSTA);
 }
 
 
-void _i2c_read_packet(packet_t *packet)
+void _i2c_read_packet(packet_t *packet, bool immediate)
 {
-    // Initialize packet_buffer
-    memset(packet_buffer, 0, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // A pending acknowledgement request needs to be answered first
+    if (status.ack_requested)
+        return;
+
+#if PACKET_QUEUE_ENABLED
+    // Hand over queued packets first, then answer a deferred poll
+    if (!immediate && !immediate_ack && (mode == _I2C_MODE_PACKET_RX || poll_pending))
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            status.result = RESULT_FAILED;
+            status.done = false;
+
+            if (packet_queue_pop(&queue, packet))
+            {
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
+            else if (poll_pending)
+            {
+                poll_pending = false;
+
+                status.ack_requested = true;
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
+            else
+            {
+                // Already listening, keep partially received packet
+                current_packet = packet;
+            }
+        }
+
+        return;
+    }
+#else
+    // Already listening in windowed mode, keep partially received packet
+    if (!immediate && !immediate_ack && mode == _I2C_MODE_PACKET_RX)
+    {
+        status.result = RESULT_FAILED;
+        status.done = false;
+        current_packet = packet;
+        return;
+    }
+#endif
+
+    immediate_ack = immediate;
+
+    // Initialize frame buffer
+    packet_frame_reset(&frame);
     mode = _I2C_MODE_PACKET_RX;
+#if PACKET_QUEUE_ENABLED
+    packet_queue_reset(&queue);
+    poll_pending = false;
+#endif
 
     status.result = RESULT_FAILED;
     status.done = false;
@@ -222,9 +346,71 @@ void _i2c_read_packet(packet_t *packet)
 
 void _i2c_abort()
 {
-    // Release TWI pins
-    TWCR = (1<<TWEN);
+    // Release TWI pins, end a burst with STOP
+    if (bus_held)
+        TWCR = (1<<TWEN) | (1<<TWINT) | (1<<TWSTO);
+    else
+        TWCR = (1<<TWEN);
+
+    bus_held = false;
+    start_pending = false;
     mode = _I2C_MODE_IDLE;
+    status.ack_requested = false;
+#if PACKET_QUEUE_ENABLED
+    poll_pending = false;
+#endif
+}
+
+
+void _i2c_send_ack(const packet_ack_t *ack)
+{
+    // Initialize ack buffer
+    memcpy(ack_buffer, ack, sizeof(packet_ack_t));
+    ack_buffer_position = 0;
+    immediate_ack = false;
+    mode = _I2C_MODE_ACK_TX;
+
+    status.ack_requested = false;
+    status.result = RESULT_FAILED;
+    status.done = false;
+
+    // The clock has been stretched since the master's request, release it
+    TWDR = ack_buffer[ack_buffer_position++];
+    TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+}
+
+
+void _i2c_read_ack(packet_ack_t *ack)
+{
+    // Initialize ack buffer
+    memset(ack_buffer, 0, sizeof(packet_ack_t));
+    ack_buffer_position = 0;
+    immediate_ack = false;
+    mode = _I2C_MODE_ACK_RX;
+    bus_held = false;
+
+    status.result = RESULT_FAILED;
+    status.done = false;
+    current_ack = ack;
+
+    // Wait for STOP of previous packet to complete
+    while (TWCR & (1<<TWSTO))
+        ;
+
+    // Enable interrupt & send START, a repeated START if the bus is still held
+    TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWSTA);
+}
+
+
+void _i2c_process()
+{
+    if (!start_pending)
+        return;
+
+    // Give slave some time and send START
+    _delay_us(200);
+    start_pending = false;
+    TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWSTA);
 }
 
 
@@ -245,18 +431,34 @@ void _i2c_packet_tx_isr()
         case MT_R_START:
             TWDR = SLAVE_W;
             TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
-            packet_buffer_position = 0;
+            frame.position = 0;
             break;
 
         // Slave address or data sent, ACK received, send next data byte
         case MT_SLA_W_ACK:
         case MT_DATA_ACK:
         {
-            if (packet_buffer_position < sizeof(packet_t))
+            if (frame.position < frame.length)
             {
-                TWDR = packet_buffer[packet_buffer_position++];
+                TWDR = frame.data[frame.position++];
                 TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
             }
+            else if (!immediate_ack)
+            {
+#if EPRO_TRANSPORT_BURST_ENABLED
+                // Burst mode, keep the bus with the clock stretched, the next
+                // packet or poll follows with a repeated START instead of STOP
+                TWCR = (1<<TWEN);
+                bus_held = true;
+#else
+                // Windowed mode, send STOP, the next packet follows right away
+                TWCR = (1<<TWEN) | (1<<TWINT) | (1<<TWSTO);
+#endif
+                mode = _I2C_MODE_IDLE;
+
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
             else
             {
                 // Disable interrupt and send STOP
@@ -264,9 +466,8 @@ void _i2c_packet_tx_isr()
 
                 mode = _I2C_MODE_ACK_RX;
 
-                // Give slave some time and send START
-                _delay_us(200);
-                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWSTA);
+                // START follows from _i2c_process()
+                start_pending = true;
             }
 
             break;
@@ -295,35 +496,78 @@ void _i2c_packet_rx_isr()
     {
         // Own address received, ACK returned
         case SR_SLA_W_ACK:
-            packet_buffer_position = 0;
+            packet_frame_reset(&frame);
             TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
             break;
 
         // Data received, ACK returned
         case SR_DATA_ACK:
         {
-            if (packet_buffer_position < sizeof(packet_t))
-            {
-                packet_buffer[packet_buffer_position++] = TWDR;
-                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+            status.active = true;
+
+            bool complete = packet_frame_push(&frame, TWDR);
+            TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
 
-                if (packet_buffer_position >= sizeof(packet_t))
+            if (complete && !immediate_ack)
+            {
+                // Hand over valid packets and keep listening, packets arriving
+                // before the next call to _i2c_read_packet() are queued if possible
+                if (current_packet)
                 {
-                    // Compute & verify checksum
-                    packet_t *packet = (packet_t*)packet_buffer;
-                    uint8_t checksum = packet_compute_checksum(packet);
-                    ack = (checksum == packet->checksum) ? ASCII_ACK : ASCII_NACK;
+                    bool valid = packet_frame_is_valid(&frame);
+                    if (valid)
+                        packet_frame_decode(&frame, current_packet);
 
-                    mode = _I2C_MODE_ACK_TX;
+                    current_packet = 0;
 
-                    // Wait for master to pick up confirmation
-                    TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+                    status.result = valid ? RESULT_SUCCESS : RESULT_FAILED;
+                    status.done = true;
                 }
+#if PACKET_QUEUE_ENABLED
+                else
+                    packet_queue_push(&queue, &frame);
+#endif
+            }
+            else if (complete)
+            {
+                // Verify checksum
+                ack = packet_frame_is_valid(&frame) ? ASCII_ACK : ASCII_NACK;
+
+                mode = _I2C_MODE_ACK_TX;
+
+                // Wait for master to pick up confirmation
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
             }
 
             break;
         }
 
+        // Own address received for reading, master polls for an acknowledgement.
+        // Keep the clock stretched until _i2c_send_ack() provides the data.
+        case ST_SLA_R_ACK:
+            if (immediate_ack)
+            {
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+                break;
+            }
+
+            TWCR = (1<<TWEN) | (1<<TWEA);
+            mode = _I2C_MODE_ACK_TX;
+
+#if PACKET_QUEUE_ENABLED
+            if (!packet_queue_is_empty(&queue))
+            {
+                poll_pending = true;
+                break;
+            }
+#endif
+
+            status.ack_requested = true;
+            status.result = RESULT_SUCCESS;
+            status.done = true;
+
+            break;
+
         // Data received, NACK returned or bus error, 
         case SR_DATA_NACK:
         case SR_BUS_ERROR:
@@ -349,15 +593,40 @@ void _i2c_ack_tx_isr()
             TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
             break;
 
-        // Data sent, NACK received, disable interrupt & release pins
+        // Data sent, ACK received, send next byte of windowed acknowledgement
+        case ST_DATA_ACK:
+            if (ack_buffer_position < sizeof(packet_ack_t))
+                TWDR = ack_buffer[ack_buffer_position++];
+            else
+                TWDR = 0xff;
+
+            TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+            break;
+
+        // Data sent, NACK received, go on listening in windowed mode
         case ST_DATA_NACK:
+        case ST_LDATA_ACK:
+            if (!immediate_ack)
+            {
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+
+                packet_frame_reset(&frame);
+                mode = _I2C_MODE_PACKET_RX;
+
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+
+                break;
+            }
+
+            // Disable interrupt & release pins
             TWCR = (1<<TWEN) | (1<<TWINT);
 
             mode = _I2C_MODE_IDLE;
             
             if (ack == ASCII_ACK && current_packet)
             {
-                memcpy(current_packet, packet_buffer, sizeof(packet_t));
+                packet_frame_decode(&frame, current_packet);
                 current_packet = 0;
             }
 
@@ -391,13 +660,42 @@ void _i2c_ack_rx_isr()
             TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
             break;
 
-        // Slave address sent, ACK received
+        // Slave address sent, ACK received, return ACK unless one byte is left
         case MR_SLA_R_ACK:
-            TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
+            if (!immediate_ack)
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+            else
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
+            break;
+
+        // Data received, ACK returned
+        case MR_DATA_ACK:
+            ack_buffer[ack_buffer_position++] = TWDR;
+            if (ack_buffer_position < sizeof(packet_ack_t) - 1)
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT) | (1<<TWEA);
+            else
+                TWCR = (1<<TWEN) | (1<<TWIE) | (1<<TWINT);
             break;
 
         // Data received, NACK returned, disable interrupt & send STOP
         case MR_DATA_NACK:
+            if (!immediate_ack)
+            {
+                ack_buffer[ack_buffer_position++] = TWDR;
+
+                TWCR = (1<<TWEN) | (1<<TWINT) | (1<<TWSTO);
+                mode = _I2C_MODE_IDLE;
+
+                memcpy(current_ack, ack_buffer, sizeof(packet_ack_t));
+                current_ack = 0;
+
+                status.result = packet_ack_is_valid((packet_ack_t*)ack_buffer) ? RESULT_SUCCESS
+                                                                               : RESULT_FAILED;
+                status.done = true;
+
+                break;
+            }
+
             ack = TWDR;
 
             TWCR = (1<<TWEN) | (1<<TWINT) | (1<<TWSTO);            
@@ -32,6 +32,12 @@ typedef struct
     volatile result_t result;
     volatile bool done;
 
+    // Set by the receiver when the sender polls for an acknowledgement
+    volatile bool ack_requested;
+
+    // Set by the driver whenever a byte arrives, cleared by the caller
+    volatile bool active;
+
 } interface_status_t;
 
 
@@ -41,10 +47,26 @@ typedef struct
     void (*initialize_rx)(bitrate_hint_t hint);
     void (*shutdown)(void);
 
-    void (*send_packet)(const packet_t *packet);
-    void (*read_packet)(packet_t *packet);
+    void (*send_packet)(const packet_t *packet, bool immediate_ack);
+    void (*read_packet)(packet_t *packet, bool immediate_ack);
     void (*abort)(void);
 
+    // Windowed transport, see EPRO_TRANSPORT_WINDOW_SIZE
+    void (*send_ack)(const packet_ack_t *ack);
+    void (*read_ack)(packet_ack_t *ack);
+
+    // Called repeatedly while waiting for the driver, 0 if all work is done in interrupts
+    void (*process)(void);
+
+#if EPRO_FULL_DUPLEX_ENABLED
+    // Full duplex, see EPRO_FULL_DUPLEX_ENABLED. Packets are sent without waiting
+    // for an acknowledgement, post_packet() fails while the last one is still
+    // going out. fetch_packet() takes a valid packet received meanwhile.
+    // 0 if the interface is half duplex.
+    bool (*post_packet)(const packet_t *packet);
+    bool (*fetch_packet)(packet_t *packet);
+#endif
+
     interface_status_t *status;
 
 } interface_driver_t;
@@ -57,6 +57,9 @@ static const uint32_t bitrates[BITRATE_HINT_COUNT] =
     115200, // BITRATE_HINT_FAST_ABERRANT
 };
 
+// Hint the endec is currently configured for, BITRATE_HINT_COUNT if shut down
+static bitrate_hint_t current_hint = BITRATE_HINT_COUNT;
+
 // Driver function
 static void _irda_initialize(bitrate_hint_t hint);
 static void _irda_shutdown(void);
@@ -76,12 +79,27 @@ void irda_alloc_interface(interface_driver_t *interface)
     interface->read_packet   = _uart_read_packet;
     interface->abort         = _uart_abort;
 
+    interface->send_ack      = _uart_send_ack;
+    interface->read_ack      = _uart_read_ack;
+    interface->process       = _uart_process;
+#if EPRO_FULL_DUPLEX_ENABLED
+    interface->post_packet   = 0;
+    interface->fetch_packet  = 0;
+#endif
+
     interface->status        = &_uart_status;
 }
 
 
 void _irda_initialize(bitrate_hint_t hint)
 {
+    // Endec already configured, only reset transfer state
+    if (hint == current_hint)
+    {
+        _uart_abort();
+        return;
+    }
+
     // Initialize port D pins as output
     DDRD |= (1<<_IRDA_PIN_IR_MODE) | (1<<_IRDA_PIN_IR_RESET);
     PORTD &= ~((1<<_IRDA_PIN_IR_MODE) | (1<<_IRDA_PIN_IR_RESET));
@@ -95,6 +113,7 @@ void _irda_initialize(bitrate_hint_t hint)
 
     // Set bitrate
     _irda_set_bitrate(hint);
+    current_hint = hint;
 }
 
 
@@ -104,6 +123,8 @@ void _irda_shutdown()
     _delay_ms(1);
     _uart_set_ir_enabled(false);
     _uart_shutdown();
+
+    current_hint = BITRATE_HINT_COUNT;
 }
 
 
@@ -26,6 +26,7 @@
 #include "lcd.h"
 #include "messagetable.h"
 #include "settings.h"
+#include "timer.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -62,6 +63,9 @@ static void read_test(void);
 
 static void send_message(void);
 static void read_message(void);
+#if EPRO_FULL_DUPLEX_ENABLED
+static void exchange_message(void);
+#endif
 
 static void show_settings(void);
 
@@ -71,35 +75,67 @@ static const menu_entry_t main_menu_entries[] =
     { "Read test",    read_test     },
     { "Send message", send_message  },
     { "Read message", read_message  },
+#if EPRO_FULL_DUPLEX_ENABLED
+    { "Exchange msg", exchange_message },
+#endif
     { "Settings",     show_settings }
 };
 
+#if EPRO_FULL_DUPLEX_ENABLED
+MENU_INIT(main_menu, "Main menu:", 6, main_menu_entries, false);
+#else
 MENU_INIT(main_menu, "Main menu:", 5, main_menu_entries, false);
+#endif
 
 
 // Function definitions
 void send(const message_t *message)
 {
+    // Keep the interface initialized & the link trained for all messages
+    if (epro_open_tx_session() == RESULT_ABORTED)
+    {
+        epro_close_session();
+
+        lcd_printf_P(1, result_strings[RESULT_ABORTED]);
+        epro_delay_ms(1000);
+        return;
+    }
+
     for (uint8_t i = 0; i < EPRO_MESSAGE_COUNT; ++i)
     {
         lcd_clear();
         lcd_printf_PSTR(0, "Sending %02d/%02d...", i+1, EPRO_MESSAGE_COUNT);
 
+        // Time each transfer, shown in debug mode to compare transport settings
+        timer_t timer;
+        timer_start(&timer);
         result_t result = epro_send_message(message);
+        uint16_t elapsed = timer.msecs;
+        timer_stop(&timer);
+
+        if (current_settings.debug)
+            lcd_printf_PSTR(0, "%02d/%02d %5ums", i+1, EPRO_MESSAGE_COUNT, elapsed);
 
         lcd_printf_P(1, result_strings[result]);
         if (result == RESULT_ABORTED || epro_wait_ms(1000) == RESULT_ABORTED)
         {
+            epro_close_session();
+
             lcd_printf_P(1, result_strings[RESULT_ABORTED]);
             epro_delay_ms(1000);
             return;
         }
     }
+
+    epro_close_session();
 }
 
 
 void read()
 {
+    // Keep the interface initialized for all messages
+    epro_open_rx_session();
+
     while (1)
     {
         lcd_clear();
@@ -112,8 +148,14 @@ void read()
         {
             char* msg = message_get_string(&message);
 
-            lcd_printf_PSTR(0, "Message:");
-            lcd_printf_PSTR(1, "%s", msg);
+            // 0 when memory runs out for the expanded text
+            if (msg)
+            {
+                lcd_printf_PSTR(0, "Message:");
+                lcd_printf_PSTR(1, "%s", msg);
+            }
+            else
+                lcd_printf_P(1, result_strings[RESULT_ERROR]);
 
             free(msg);
         }
@@ -125,6 +167,8 @@ void read()
 
         if (result == RESULT_ABORTED || epro_wait_ms(800) == RESULT_ABORTED)
         {
+            epro_close_session();
+
             lcd_printf_P(1, result_strings[RESULT_ABORTED]);
             epro_delay_ms(1000);
             return;
@@ -177,6 +221,50 @@ void read_message()
 }
 
 
+#if EPRO_FULL_DUPLEX_ENABLED
+void exchange_message()
+{
+    epro_set_bitrate_hint(BITRATE_HINT_SLOW_REGULAR);
+
+    char *string = message_table_read_at(current_settings.message_index);
+
+    message_t msg;
+    message_init(&msg, string, current_settings.message_key);
+    free(string);
+
+    lcd_clear();
+    lcd_printf_PSTR(0, "Exchanging...");
+
+    message_t message;
+    result_t result = epro_exchange_messages(&msg, &message);
+    message_free(&msg);
+
+    if (current_settings.debug && result == RESULT_SUCCESS)
+    {
+        char* received = message_get_string(&message);
+
+        // 0 when memory runs out for the expanded text
+        if (received)
+        {
+            lcd_printf_PSTR(0, "Received:");
+            lcd_printf_PSTR(1, "%s", received);
+        }
+        else
+            lcd_printf_P(1, result_strings[RESULT_ERROR]);
+
+        free(received);
+    }
+    else
+        lcd_printf_P(1, result_strings[result]);
+
+    if (result == RESULT_SUCCESS)
+        message_free(&message);
+
+    epro_delay_ms(2000);
+}
+#endif
+
+
 void show_settings()
 {
     settings_process_menu(&current_settings);
@@ -188,6 +276,9 @@ int main(void)
     // Load settings from EEPROM & initialize ePro library
     settings_load(&current_settings);
     epro_initialize(current_settings.interface_index);
+#if EPRO_RS232_MULTIDROP_ENABLED
+    epro_set_bus_addresses(current_settings.bus_address, current_settings.bus_peer);
+#endif
 
     // Print info
     lcd_printf_PSTR(0, "ePro Firmware");
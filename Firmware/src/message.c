@@ -21,6 +21,7 @@
 //                                                                                                //
 // ============================================================================================== //
 
+#include "compress.h"
 #include "message.h"
 #include "util.h"
 
@@ -32,11 +33,30 @@
 // Private functions
 static uint16_t _message_get_block_count(const message_header_t *header);
 static void _message_cipher(const uint8_t *block, const uint8_t *key, uint8_t *result);
+static uint32_t _message_update_digest(uint32_t digest, const uint8_t *data, uint8_t length);
+static bool _message_alloc_assembly(message_t *message, message_assembly_t *assembly, uint16_t packet_count);
+static bool _message_alloc_blocks(message_t *message);
 
 
 void message_init(message_t *message, const char *string, const uint8_t *key)
 {
+    const uint8_t *data = (const uint8_t*)string;
     uint16_t message_len = strlen(string);
+
+    memset(message->header.block_count, 0, EPRO_BLOCK_LENGTH);
+
+#if EPRO_COMPRESSION_ENABLED
+    // Only used if it saves something, the compressed data includes the NUL
+    uint8_t *compressed = (uint8_t*)malloc(message_len + 1);
+    uint16_t compressed_len = compressed ? compress_string(string, compressed) : 0;
+    if (compressed_len > 0 && compressed_len < message_len)
+    {
+        data = compressed;
+        message_len = compressed_len;
+        message->header.block_count[MESSAGE_FLAGS_OFFSET] = MESSAGE_FLAG_COMPRESSED;
+    }
+#endif
+
     uint16_t num_blocks = message_len / EPRO_BLOCK_LENGTH;
     if (message_len % EPRO_BLOCK_LENGTH > 0)
         num_blocks++;
@@ -46,17 +66,26 @@ void message_init(message_t *message, const char *string, const uint8_t *key)
     else
         memset(message->header.key, 0, EPRO_BLOCK_LENGTH);
 
-    snprintf((char*)message->header.block_count, EPRO_BLOCK_LENGTH, "%d", num_blocks);
+    snprintf((char*)message->header.block_count, MESSAGE_FLAGS_OFFSET, "%d", num_blocks);
 
     message->blocks = (message_block_t*)malloc(num_blocks * sizeof(message_block_t));
     for (uint16_t i = 0; i < num_blocks; ++i)
     {
-        // Cipher message block
-        uint8_t result[EPRO_BLOCK_LENGTH];
-        _message_cipher((uint8_t*)string + i*EPRO_BLOCK_LENGTH, message->header.key, result);
+        // Last block is padded with zeros
+        uint8_t block[EPRO_BLOCK_LENGTH];
+        memset(block, 0, EPRO_BLOCK_LENGTH);
+
+        uint16_t offset = i*EPRO_BLOCK_LENGTH;
+        memcpy(block, data + offset, (message_len - offset < EPRO_BLOCK_LENGTH) ? message_len - offset
+                                                                                 : EPRO_BLOCK_LENGTH);
 
-        memcpy(message->blocks[i].data, result, EPRO_BLOCK_LENGTH);
+        // Cipher message block
+        _message_cipher(block, message->header.key, message->blocks[i].data);
     }
+
+#if EPRO_COMPRESSION_ENABLED
+    free(compressed);
+#endif
 }
 
 
@@ -70,7 +99,10 @@ char* message_get_string(const message_t *message)
 {
     uint16_t block_count = _message_get_block_count(&message->header);
 
-    char *string = (char*)malloc(block_count * EPRO_BLOCK_LENGTH);
+    char *string = (char*)malloc(block_count * EPRO_BLOCK_LENGTH + 1);
+    if (!string)
+        return 0;
+
     for (uint16_t i = 0; i < block_count; ++i)
     {
         // Decipher message block
@@ -80,56 +112,251 @@ char* message_get_string(const message_t *message)
         memcpy(string + i*EPRO_BLOCK_LENGTH, result, EPRO_BLOCK_LENGTH);
     }
 
+    string[block_count * EPRO_BLOCK_LENGTH] = '\0';
+
+#if EPRO_COMPRESSION_ENABLED
+    if (message->header.block_count[MESSAGE_FLAGS_OFFSET] == MESSAGE_FLAG_COMPRESSED)
+    {
+        const uint8_t *data = (const uint8_t*)string;
+        uint16_t length = block_count * EPRO_BLOCK_LENGTH;
+
+        char *expanded = (char*)malloc(compress_get_string_length(data, length) + 1);
+        if (expanded)
+            compress_expand(data, length, expanded);
+
+        free(string);
+        return expanded;
+    }
+#endif
+
     return string;
 }
 
 
-void message_to_packets(const message_t *message, packet_t **packets, uint16_t *num_packets)
+uint32_t message_get_digest(const message_t *message)
 {
+    // 32 bit FNV-1a over header & blocks
+    uint32_t digest = 2166136261UL;
+
+    digest = _message_update_digest(digest, (const uint8_t*)&message->header, sizeof(message_header_t));
+
     uint16_t block_count = _message_get_block_count(&message->header);
+    for (uint16_t i = 0; i < block_count; ++i)
+        digest = _message_update_digest(digest, message->blocks[i].data, EPRO_BLOCK_LENGTH);
+
+    return digest;
+}
+
+
+bool message_copy(message_t *dst, const message_t *src)
+{
+    uint16_t block_count = _message_get_block_count(&src->header);
+
+    dst->header = src->header;
+    dst->blocks = (message_block_t*)malloc(block_count * sizeof(message_block_t));
+    if (!dst->blocks && block_count > 0)
+        return false;
+
+    memcpy(dst->blocks, src->blocks, block_count * sizeof(message_block_t));
+    return true;
+}
+
 
-    *num_packets = block_count + 2;
-    *packets = (packet_t*)malloc(*num_packets * sizeof(packet_t));
-    if (*packets == 0)
+uint16_t message_get_packet_count(const message_t *message)
+{
+    const uint8_t blocks_per_packet = EPRO_PACKET_MAX_PAYLOAD / EPRO_BLOCK_LENGTH;
+
+    // The message header takes two blocks
+    uint32_t total_blocks = (uint32_t)_message_get_block_count(&message->header) + 2;
+
+    uint32_t packet_count = (total_blocks + blocks_per_packet - 1) / blocks_per_packet;
+    if (packet_count > PACKET_MAX_INDEX)
+        return 0;
+
+    return packet_count;
+}
+
+
+bool message_get_packet(const message_t *message, uint16_t index, packet_t *packet)
+{
+    const uint8_t blocks_per_packet = EPRO_PACKET_MAX_PAYLOAD / EPRO_BLOCK_LENGTH;
+
+    // Packets are numbered from 1
+    uint16_t packet_count = message_get_packet_count(message);
+    if (index < 1 || index > packet_count)
+        return false;
+
+    uint32_t total_blocks = (uint32_t)_message_get_block_count(&message->header) + 2;
+    uint32_t block = (uint32_t)(index - 1) * blocks_per_packet;
+
+    packet->index = index;
+    packet->total = packet_count;
+    packet->stream = 0;
+    packet->ack = 0;
+    packet->length = 0;
+
+    // Pack header & message blocks back to back, as many as fit into a packet
+    for (uint8_t i = 0; i < blocks_per_packet && block < total_blocks; ++i, ++block)
     {
-        *num_packets = 0;
-        return;
+        const uint8_t *data = (block < 2) ? (const uint8_t*)&message->header + block*EPRO_BLOCK_LENGTH
+                                          : message->blocks[block-2].data;
+
+        memcpy(packet->data + packet->length, data, EPRO_BLOCK_LENGTH);
+        packet->length += EPRO_BLOCK_LENGTH;
     }
 
-    // Create packets for header
-    uint8_t header_buffer[2*EPRO_BLOCK_LENGTH];
-    memcpy(header_buffer, &message->header, sizeof(message_header_t));
+    return true;
+}
 
-    packet_init(&(*packets)[0], 1, *num_packets, &header_buffer[0]);
-    packet_init(&(*packets)[1], 2, *num_packets, &header_buffer[EPRO_BLOCK_LENGTH]);
 
-    // Create packets for message blocks
-    for (uint16_t i = 0; i < block_count; ++i)
-        packet_init(&(*packets)[i+2], i+3, *num_packets, message->blocks[i].data);
+void message_assembly_init(message_assembly_t *assembly)
+{
+    assembly->packet_count = 0;
+    assembly->packets_received = 0;
+    assembly->blocks_received = 0;
+    assembly->received = 0;
 }
 
 
-void message_from_packets(message_t *message, const packet_t *packets, uint16_t num_packets)
+void message_assembly_free(message_assembly_t *assembly)
 {
-    // The message header takes two packets
-    if (num_packets < 2)
-        return;
+    free(assembly->received);
+    message_assembly_init(assembly);
+}
 
-    uint8_t header_buffer[2*EPRO_BLOCK_LENGTH];
-    memcpy(&header_buffer[0*EPRO_BLOCK_LENGTH], packets[0].data, EPRO_BLOCK_LENGTH);
-    memcpy(&header_buffer[1*EPRO_BLOCK_LENGTH], packets[1].data, EPRO_BLOCK_LENGTH);
 
-    message_header_t header;
-    memcpy(&header, header_buffer, sizeof(message_header_t));
+bool message_add_packet(message_t *message, message_assembly_t *assembly, const packet_t *packet)
+{
+    const uint8_t blocks_per_packet = EPRO_PACKET_MAX_PAYLOAD / EPRO_BLOCK_LENGTH;
 
-    uint16_t block_count = _message_get_block_count(&header);
-    if (block_count != (num_packets - 2))
-        return;
+    uint16_t index = packet_get_index(packet);
+    uint16_t total = packet_get_total(packet);
 
-    message->header = header;
-    message->blocks = (message_block_t*)malloc(block_count * sizeof(message_block_t));
-    for (uint16_t i = 0; i < block_count; ++i)
-        memcpy(message->blocks[i].data, packets[i+2].data, EPRO_BLOCK_LENGTH);
+    // Packets that don't fit the message are dropped, a stale repeat of the
+    // previous message's last packet must not fail or corrupt the next one
+    if (index < 1 || index > total || (uint32_t)total * blocks_per_packet < 2)
+        return true;
+
+    // All packets but the last one are full
+    if (packet->length == 0 || packet->length % EPRO_BLOCK_LENGTH != 0 ||
+        (index < total && packet->length != blocks_per_packet * EPRO_BLOCK_LENGTH))
+        return true;
+
+    if (assembly->received && total != assembly->packet_count)
+    {
+        // Only the first packet of another message starts over
+        if (index != 1)
+            return true;
+
+        message_assembly_free(assembly);
+    }
+
+    // A message starts with its first packet
+    if (!assembly->received)
+    {
+        if (index != 1)
+            return true;
+
+        if (!_message_alloc_assembly(message, assembly, total))
+            return false;
+    }
+
+    // Duplicates are dropped
+    uint8_t mask = (1 << ((index - 1) % 8));
+    if (assembly->received[(index - 1) / 8] & mask)
+        return true;
+
+    uint32_t block = (uint32_t)(index - 1) * blocks_per_packet;
+    uint8_t count = packet->length / EPRO_BLOCK_LENGTH;
+
+    // The header takes the first two blocks and sizes the block storage. Data
+    // blocks arriving before it is complete are dropped, the sender repeats them.
+    bool header_known = (assembly->blocks_received >= 2);
+    if (!header_known)
+    {
+        if (block >= 2)
+            return true;
+
+        uint8_t header_blocks = (count < 2 - block) ? count : 2 - block;
+        if (assembly->blocks_received + header_blocks >= 2)
+        {
+            memcpy((uint8_t*)&message->header + block*EPRO_BLOCK_LENGTH, packet->data,
+                   header_blocks * EPRO_BLOCK_LENGTH);
+
+            // A stale or corrupted header doesn't get to size the allocation
+            if (message_get_packet_count(message) != assembly->packet_count)
+            {
+                message_assembly_free(assembly);
+                return true;
+            }
+
+            if (!_message_alloc_blocks(message))
+                return false;
+
+            header_known = true;
+        }
+    }
+
+    // Once the header is known, the last packet has to carry exactly the blocks left
+    if (header_known)
+    {
+        uint32_t total_blocks = (uint32_t)_message_get_block_count(&message->header) + 2;
+        if (block + count > total_blocks || (index == total && block + count != total_blocks))
+            return true;
+    }
+
+    for (uint8_t offset = 0; offset < packet->length; offset += EPRO_BLOCK_LENGTH, ++block)
+    {
+        // The message header takes two blocks
+        uint8_t *data = (block < 2) ? (uint8_t*)&message->header + block*EPRO_BLOCK_LENGTH
+                                    : message->blocks[block-2].data;
+
+        memcpy(data, packet->data + offset, EPRO_BLOCK_LENGTH);
+    }
+
+    assembly->received[(index - 1) / 8] |= mask;
+    assembly->packets_received++;
+    assembly->blocks_received += packet->length / EPRO_BLOCK_LENGTH;
+
+    return true;
+}
+
+
+bool message_has_packet(const message_assembly_t *assembly, uint16_t index)
+{
+    if (!assembly->received)
+        return false;
+
+    // There is nothing missing beyond the last packet
+    if (index < 1 || index > assembly->packet_count)
+        return true;
+
+    return (assembly->received[(index - 1) / 8] & (1 << ((index - 1) % 8)));
+}
+
+
+uint16_t message_get_missing_packet(const message_assembly_t *assembly)
+{
+    if (!assembly->received)
+        return 1;
+
+    for (uint32_t i = 1; i <= assembly->packet_count; ++i)
+    {
+        if (!message_has_packet(assembly, i))
+            return i;
+    }
+
+    return assembly->packet_count + 1;
+}
+
+
+bool message_is_complete(const message_t *message, const message_assembly_t *assembly)
+{
+    if (!assembly->received || assembly->packets_received != assembly->packet_count)
+        return false;
+
+    // Reject headers not matching the number of blocks received
+    return (assembly->blocks_received == (uint32_t)_message_get_block_count(&message->header) + 2);
 }
 
 
@@ -139,6 +366,51 @@ uint16_t _message_get_block_count(const message_header_t *header)
 }
 
 
+bool _message_alloc_assembly(message_t *message, message_assembly_t *assembly, uint16_t packet_count)
+{
+    free(message->blocks);
+    message->blocks = 0;
+
+    if (packet_count == 0)
+        return false;
+
+    // One bit per packet, the blocks follow once the header is known
+    assembly->received = (uint8_t*)calloc((packet_count + 7) / 8, 1);
+    if (!assembly->received)
+        return false;
+
+    assembly->packet_count = packet_count;
+    return true;
+}
+
+
+bool _message_alloc_blocks(message_t *message)
+{
+    uint16_t block_count = _message_get_block_count(&message->header);
+
+    free(message->blocks);
+    message->blocks = 0;
+
+    if (block_count == 0)
+        return true;
+
+    message->blocks = (message_block_t*)malloc(block_count * sizeof(message_block_t));
+    return (message->blocks != 0);
+}
+
+
+uint32_t _message_update_digest(uint32_t digest, const uint8_t *data, uint8_t length)
+{
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        digest ^= data[i];
+        digest *= 16777619UL;
+    }
+
+    return digest;
+}
+
+
 void _message_cipher(const uint8_t *block, const uint8_t *key, uint8_t *result)
 {
     for (uint8_t i = 0; i < EPRO_BLOCK_LENGTH; ++i)
@@ -27,6 +27,10 @@
 #include "config.h"
 #include "packet.h"
 
+// The block count is stored as a NUL terminated number, flags follow in the last byte
+#define MESSAGE_FLAGS_OFFSET (EPRO_BLOCK_LENGTH - 1)
+#define MESSAGE_FLAG_COMPRESSED 'Z'
+
 typedef struct
 {
     uint8_t block_count[EPRO_BLOCK_LENGTH];
@@ -47,11 +51,37 @@ typedef struct
 
 } message_t;
 
+typedef struct
+{
+    uint16_t packet_count;
+    uint16_t packets_received;
+    uint32_t blocks_received;
+
+    // Bitmap of packets received, one bit per packet
+    uint8_t *received;
+
+} message_assembly_t;
+
 void message_init(message_t *message, const char *string, const uint8_t *key);
 void message_free(message_t *message);
 
-void message_to_packets(const message_t *message, packet_t **packets, uint16_t *num_packets);
-void message_from_packets(message_t *message, const packet_t *packets, uint16_t num_packets);
+// Identifies a message when resuming an interrupted transfer or looking up a cached copy
+uint32_t message_get_digest(const message_t *message);
+bool message_copy(message_t *dst, const message_t *src);
+
+uint16_t message_get_packet_count(const message_t *message);
+bool message_get_packet(const message_t *message, uint16_t index, packet_t *packet);
+
+// Reassembles received packets, the first one has to arrive first. Duplicates
+// & packets that don't belong to the message are dropped, a first packet with
+// another total starts over. Returns false only when memory runs out. Set
+// message->blocks to 0 before adding the first packet.
+void message_assembly_init(message_assembly_t *assembly);
+void message_assembly_free(message_assembly_t *assembly);
+bool message_add_packet(message_t *message, message_assembly_t *assembly, const packet_t *packet);
+bool message_has_packet(const message_assembly_t *assembly, uint16_t index);
+uint16_t message_get_missing_packet(const message_assembly_t *assembly);
+bool message_is_complete(const message_t *message, const message_assembly_t *assembly);
 
 char* message_get_string(const message_t *message);
 
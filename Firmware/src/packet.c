@@ -22,63 +22,711 @@
 // ============================================================================================== //
 
 #include "packet.h"
-#include "util.h"
+#include "types.h"
+
+#include <avr/pgmspace.h>
 
-#include <stdio.h>
 #include <string.h>
 
-void packet_init(packet_t *packet, uint8_t index, uint8_t total, const void *data)
+// CRC-16/CCITT lookup table, polynomial 0x1021
+static const uint16_t crc16_table[256] PROGMEM =
 {
-    char string[4];
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
 
-    *(uint8_t*)(&packet->magic_number) = PACKET_MAGIC_NUMBER;
+// Private functions
+#if !EPRO_BINARY_HEADER_ENABLED
+static void _packet_number_to_ascii(uint16_t number, uint8_t *digits);
+#endif
+static uint16_t _packet_ascii_to_number(const uint8_t *digits);
+static uint8_t _packet_get_header_length(uint8_t version);
+static uint8_t _packet_get_trailer_length(uint8_t version);
+static void _packet_frame_correct(packet_frame_t *frame);
+static uint8_t _packet_gf_xtime(uint8_t value);
+#if EPRO_FEC_ENABLED
+static void _packet_rs_encode(const uint8_t *data, uint8_t length, uint8_t *parity);
+#endif
+static bool _packet_rs_correct(uint8_t *data, uint8_t length);
+static uint8_t _packet_compute_sum(const uint8_t *data, uint8_t length);
+#if EPRO_COBS_FRAMING_ENABLED
+static uint8_t _packet_get_frame_length(const uint8_t *data, uint8_t length);
+static uint8_t _packet_cobs_encode(const uint8_t *src, uint8_t length, uint8_t *dst);
+static uint8_t _packet_cobs_decode(uint8_t *data, uint8_t length);
+#endif
+static uint8_t _packet_compute_ack_checksum(const packet_ack_t *ack);
 
-    memset(string, 0, sizeof(string));
-    snprintf(string, 3, "%hhu", index);
-    memcpy(packet->index, string, 3);
 
-    memset(string, 0, sizeof(string));
-    snprintf(string, 3, "%hhu", total);
-    memcpy(packet->total, string, 3);
+void packet_init(packet_t *packet, uint16_t index, uint16_t total, const void *data, uint8_t length)
+{
+    if (length > EPRO_PACKET_MAX_PAYLOAD)
+        length = EPRO_PACKET_MAX_PAYLOAD;
 
-    memcpy(packet->data, data, EPRO_BLOCK_LENGTH);
+    packet->index = index;
+    packet->total = total;
+    packet->stream = 0;
+    packet->ack = 0;
+    packet->length = length;
 
-    packet->checksum = packet_compute_checksum(packet);
+    memcpy(packet->data, data, length);
 }
 
 
 void packet_copy(packet_t *dst, const packet_t *src)
 {
-    *(uint8_t*)(&dst->magic_number) = PACKET_MAGIC_NUMBER;
+    memcpy(dst, src, sizeof(packet_t));
+}
+
 
-    memcpy(dst->index, src->index, 3);
-    memcpy(dst->total, src->total, 3);
-    memcpy(dst->data, src->data, EPRO_BLOCK_LENGTH);
-    dst->checksum = src->checksum;
+uint16_t packet_get_index(const packet_t *packet)
+{
+    return packet->index;
 }
 
 
-uint8_t packet_get_index(const packet_t *packet)
+uint16_t packet_get_total(const packet_t *packet)
 {
-    return block_to_number(packet->index, 3);
+    return packet->total;
 }
 
 
-uint8_t packet_get_total(const packet_t *packet)
+uint8_t packet_get_length(const packet_t *packet)
 {
-    return block_to_number(packet->total, 3);
+    return packet->length;
 }
 
 
 uint8_t packet_compute_checksum(const packet_t *packet)
+{
+    return _packet_compute_sum(packet->data, packet->length);
+}
+
+
+uint16_t packet_compute_crc16(const uint8_t *data, uint8_t length)
+{
+    uint16_t crc = 0xffff;
+
+    while (length-- > 0)
+        crc = (crc << 8) ^ pgm_read_word(&crc16_table[(uint8_t)(crc >> 8) ^ *data++]);
+
+    return crc;
+}
+
+
+void packet_frame_encode(packet_frame_t *frame, const packet_t *packet)
+{
+    uint8_t *data = frame->data;
+
+    *data++ = PACKET_MAGIC_NUMBER;
+
+#if EPRO_BINARY_HEADER_ENABLED
+    // Packets of regular block length omit the length byte
+    uint8_t version = PACKET_VERSION_BINARY;
+#if EPRO_CRC16_ENABLED
+    version |= PACKET_FLAG_CRC16;
+#endif
+#if EPRO_FEC_ENABLED
+    version |= PACKET_FLAG_FEC;
+#endif
+    if (packet->length != EPRO_BLOCK_LENGTH)
+        version |= PACKET_FLAG_LENGTH;
+
+    // Stream 0 omits the stream byte, packets acknowledging nothing the ack field
+    if (packet->stream != 0)
+        version |= PACKET_FLAG_STREAM;
+
+    if (packet->ack != 0)
+        version |= PACKET_FLAG_ACK;
+
+    *data++ = version;
+    *data++ = (uint8_t)(packet->index >> 8);
+    *data++ = (uint8_t)packet->index;
+    *data++ = (uint8_t)(packet->total >> 8);
+    *data++ = (uint8_t)packet->total;
+
+    if (version & PACKET_FLAG_ACK)
+    {
+        *data++ = (uint8_t)(packet->ack >> 8);
+        *data++ = (uint8_t)packet->ack;
+    }
+
+    if (version & PACKET_FLAG_STREAM)
+        *data++ = packet->stream;
+
+    if (version & PACKET_FLAG_LENGTH)
+        *data++ = packet->length;
+#else
+    _packet_number_to_ascii(packet->index, data);
+    _packet_number_to_ascii(packet->total, data + 3);
+    data += 6;
+#endif
+
+    memcpy(data, packet->data, packet->length);
+    data += packet->length;
+
+#if EPRO_CRC16_ENABLED
+    uint16_t crc = packet_compute_crc16(frame->data + 1, data - frame->data - 1);
+    *data++ = (uint8_t)(crc >> 8);
+    *data++ = (uint8_t)crc;
+#else
+    *data++ = packet_compute_checksum(packet);
+#endif
+
+#if EPRO_FEC_ENABLED
+    // Parity covers everything following the version byte
+    _packet_rs_encode(frame->data + 2, data - frame->data - 2, data);
+    data += 2;
+#endif
+
+    frame->length = data - frame->data;
+    frame->position = 0;
+
+#if EPRO_COBS_FRAMING_ENABLED
+    // Stuff everything following the magic number & append closing delimiter
+    uint8_t body[PACKET_MAX_FRAME_LENGTH];
+    memcpy(body, frame->data + 1, frame->length - 1);
+
+    frame->length = 1 + _packet_cobs_encode(body, frame->length - 1, frame->data + 1);
+    frame->data[frame->length++] = PACKET_MAGIC_NUMBER;
+#endif
+}
+
+
+void packet_frame_decode(const packet_frame_t *frame, packet_t *packet)
+{
+    const uint8_t *data = frame->data + 1;
+
+    if ((*data & PACKET_VERSION_MASK) == PACKET_VERSION_BINARY)
+    {
+        packet->index = ((uint16_t)data[1] << 8) | data[2];
+        packet->total = ((uint16_t)data[3] << 8) | data[4];
+        packet->stream = 0;
+        packet->ack = 0;
+        packet->length = EPRO_BLOCK_LENGTH;
+
+        uint8_t version = *data;
+        data += 5;
+
+        if (version & PACKET_FLAG_ACK)
+        {
+            packet->ack = ((uint16_t)data[0] << 8) | data[1];
+            data += 2;
+        }
+
+        if (version & PACKET_FLAG_STREAM)
+            packet->stream = *data++;
+
+        if (version & PACKET_FLAG_LENGTH)
+            packet->length = *data++;
+    }
+    else
+    {
+        packet->index = _packet_ascii_to_number(data);
+        packet->total = _packet_ascii_to_number(data + 3);
+        packet->stream = 0;
+        packet->ack = 0;
+        packet->length = EPRO_BLOCK_LENGTH;
+        data += 6;
+    }
+
+    memcpy(packet->data, data, packet->length);
+}
+
+
+void packet_frame_reset(packet_frame_t *frame)
+{
+    frame->length = 0;
+
+#if EPRO_COBS_FRAMING_ENABLED
+    // Delimiters are shared, the one closing a frame also opens the next
+    frame->data[0] = PACKET_MAGIC_NUMBER;
+    frame->position = 1;
+#else
+    frame->position = 0;
+#endif
+}
+
+
+bool packet_frame_is_empty(const packet_frame_t *frame)
+{
+#if EPRO_COBS_FRAMING_ENABLED
+    return (frame->position <= 1);
+#else
+    return (frame->position == 0);
+#endif
+}
+
+
+bool packet_frame_push(packet_frame_t *frame, uint8_t byte)
+{
+#if EPRO_COBS_FRAMING_ENABLED
+    // Frame already complete, wait for reset
+    if (frame->length > 0)
+        return false;
+
+    if (byte == PACKET_MAGIC_NUMBER)
+    {
+        // Closing delimiter, unstuff frame body in place
+        if (frame->position > 1)
+        {
+            uint8_t length = 1 + _packet_cobs_decode(frame->data + 1, frame->position - 1);
+            if (length == _packet_get_frame_length(frame->data, length))
+            {
+                frame->length = length;
+                frame->position = length;
+
+                _packet_frame_correct(frame);
+                return true;
+            }
+        }
+
+        // Empty or broken frame, the delimiter starts the next one
+        packet_frame_reset(frame);
+        return false;
+    }
+
+    // Discard overrunning frame, resynchronize at the next delimiter
+    if (frame->position >= PACKET_MAX_FRAME_LENGTH)
+    {
+        frame->position = 0;
+        return false;
+    }
+    else if (frame->position == 0)
+        return false;
+
+    frame->data[frame->position++] = byte;
+    return false;
+#else
+    // Frame already complete, wait for reset
+    if (frame->length > 0 && frame->position >= frame->length)
+        return false;
+
+    // The magic number starts a new frame unless it is part of a binary frame
+    bool binary = (frame->position > 1 && (frame->data[1] & PACKET_VERSION_MASK) == PACKET_VERSION_BINARY);
+    if (byte == PACKET_MAGIC_NUMBER && !binary)
+        packet_frame_reset(frame);
+    else if (frame->position == 0)
+        return false;
+
+    // Discard overrunning frame & hunt for the next magic number
+    if (frame->position >= PACKET_MAX_FRAME_LENGTH)
+    {
+        packet_frame_reset(frame);
+        return false;
+    }
+
+    frame->data[frame->position++] = byte;
+
+    // The byte following the magic number tells the header format
+    if (frame->position == 2)
+    {
+        if ((byte & PACKET_VERSION_MASK) != PACKET_VERSION_BINARY)
+            frame->length = PACKET_ASCII_FRAME_LENGTH;
+        else if (byte & ~(PACKET_VERSION_MASK | PACKET_FLAGS_SUPPORTED))
+        {
+            packet_frame_reset(frame);
+            return false;
+        }
+        else if (!(byte & PACKET_FLAG_LENGTH))
+            frame->length = _packet_get_header_length(byte) + EPRO_BLOCK_LENGTH + _packet_get_trailer_length(byte);
+    }
+
+    // Variable length frames are sized by the length byte following the header
+    else if (frame->length == 0 && frame->position == _packet_get_header_length(frame->data[1]) + 1)
+    {
+        if (byte > EPRO_PACKET_MAX_PAYLOAD)
+        {
+            // Drop oversized frame & hunt for the next magic number
+            packet_frame_reset(frame);
+            return false;
+        }
+
+        frame->length = frame->position + byte + _packet_get_trailer_length(frame->data[1]);
+    }
+
+    // Announced frame would not fit the buffer
+    if (frame->length > PACKET_MAX_FRAME_LENGTH)
+    {
+        packet_frame_reset(frame);
+        return false;
+    }
+
+    if (frame->length == 0 || frame->position < frame->length)
+        return false;
+
+    _packet_frame_correct(frame);
+    return true;
+#endif
+}
+
+
+bool packet_frame_is_valid(const packet_frame_t *frame)
+{
+    if (frame->length == 0 || frame->position < frame->length)
+        return false;
+
+    bool binary = ((frame->data[1] & PACKET_VERSION_MASK) == PACKET_VERSION_BINARY);
+
+    // Parity bytes have already been applied by packet_frame_push()
+    uint8_t length = frame->length;
+    if (binary && (frame->data[1] & PACKET_FLAG_FEC))
+        length -= 2;
+
+    // The CRC covers everything following the magic number
+    if (binary && (frame->data[1] & PACKET_FLAG_CRC16))
+    {
+        uint16_t crc = packet_compute_crc16(frame->data + 1, length - 3);
+        return ((uint8_t)(crc >> 8) == frame->data[length - 2] &&
+                (uint8_t)crc == frame->data[length - 1]);
+    }
+
+    // The checksum only covers the data block
+    uint8_t offset = 1 + 3 + 3;
+    if (binary)
+    {
+        offset = _packet_get_header_length(frame->data[1]);
+        if (frame->data[1] & PACKET_FLAG_LENGTH)
+            offset++;
+    }
+
+    uint8_t checksum = _packet_compute_sum(frame->data + offset, length - offset - 1);
+    return (checksum == frame->data[length - 1]);
+}
+
+
+void packet_ack_init(packet_ack_t *ack, uint8_t code, uint16_t index, uint8_t credit)
+{
+    ack->code = code;
+    ack->index = index;
+    ack->credit = credit;
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+    memset(ack->missing, 0, PACKET_ACK_BITMAP_LENGTH);
+#endif
+    ack->checksum = _packet_compute_ack_checksum(ack);
+}
+
+
+bool packet_ack_is_valid(const packet_ack_t *ack)
+{
+    if (ack->code != ASCII_ACK && ack->code != ASCII_NACK)
+        return false;
+
+    return (ack->checksum == _packet_compute_ack_checksum(ack));
+}
+
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+void packet_ack_set_missing(packet_ack_t *ack, uint8_t offset)
+{
+    if (offset >= EPRO_TRANSPORT_WINDOW_SIZE)
+        return;
+
+    ack->missing[offset / 8] |= (1 << (offset % 8));
+    ack->checksum = _packet_compute_ack_checksum(ack);
+}
+
+
+bool packet_ack_is_missing(const packet_ack_t *ack, uint16_t offset)
+{
+    if (offset >= EPRO_TRANSPORT_WINDOW_SIZE)
+        return true;
+
+    return (ack->missing[offset / 8] & (1 << (offset % 8)));
+}
+#endif
+
+
+#if PACKET_QUEUE_ENABLED
+void packet_queue_reset(packet_queue_t *queue)
+{
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+
+bool packet_queue_is_empty(const packet_queue_t *queue)
+{
+    return (queue->head == queue->tail);
+}
+
+
+bool packet_queue_push(packet_queue_t *queue, const packet_frame_t *frame)
+{
+    uint8_t tail = queue->tail;
+    uint8_t count = (tail + 2*EPRO_RX_QUEUE_LENGTH - queue->head) % (2*EPRO_RX_QUEUE_LENGTH);
+    if (count >= EPRO_RX_QUEUE_LENGTH || !packet_frame_is_valid(frame))
+        return false;
+
+    packet_frame_decode(frame, &queue->slots[tail % EPRO_RX_QUEUE_LENGTH]);
+    queue->tail = (tail + 1) % (2*EPRO_RX_QUEUE_LENGTH);
+
+    return true;
+}
+
+
+bool packet_queue_pop(packet_queue_t *queue, packet_t *packet)
+{
+    uint8_t head = queue->head;
+    if (head == queue->tail)
+        return false;
+
+    packet_copy(packet, &queue->slots[head % EPRO_RX_QUEUE_LENGTH]);
+    queue->head = (head + 1) % (2*EPRO_RX_QUEUE_LENGTH);
+
+    return true;
+}
+#endif
+
+
+#if !EPRO_BINARY_HEADER_ENABLED
+void _packet_number_to_ascii(uint16_t number, uint8_t *digits)
+{
+    // Left-aligned & NUL padded, as produced by snprintf() in older firmware
+    uint8_t buffer[3];
+    uint8_t count = 0;
+
+    do
+    {
+        buffer[count++] = '0' + number % 10;
+        number /= 10;
+    }
+    while (number > 0 && count < 3);
+
+    for (uint8_t i = 0; i < 3; ++i)
+        digits[i] = (i < count) ? buffer[count - 1 - i] : '\0';
+}
+#endif
+
+
+uint16_t _packet_ascii_to_number(const uint8_t *digits)
+{
+    uint16_t number = 0;
+
+    for (uint8_t i = 0; i < 3 && digits[i] >= '0' && digits[i] <= '9'; ++i)
+        number = 10 * number + (digits[i] - '0');
+
+    return number;
+}
+
+
+uint8_t _packet_get_header_length(uint8_t version)
+{
+    return PACKET_BINARY_HEADER_LENGTH + ((version & PACKET_FLAG_STREAM) ? 1 : 0)
+                                       + ((version & PACKET_FLAG_ACK) ? 2 : 0);
+}
+
+
+uint8_t _packet_get_trailer_length(uint8_t version)
+{
+    uint8_t length = (version & PACKET_FLAG_CRC16) ? 2 : 1;
+
+    if (version & PACKET_FLAG_FEC)
+        length += 2;
+
+    return length;
+}
+
+
+void _packet_frame_correct(packet_frame_t *frame)
+{
+    // Corrected frames still have to pass the checksum or CRC
+    if ((frame->data[1] & PACKET_VERSION_MASK) == PACKET_VERSION_BINARY &&
+        (frame->data[1] & PACKET_FLAG_FEC))
+    {
+        _packet_rs_correct(frame->data + 2, frame->length - 2);
+    }
+}
+
+
+uint8_t _packet_gf_xtime(uint8_t value)
+{
+    // Multiplication by a = 2 in GF(256), polynomial 0x11d
+    return (value << 1) ^ ((value & 0x80) ? 0x1d : 0x00);
+}
+
+
+#if EPRO_FEC_ENABLED
+void _packet_rs_encode(const uint8_t *data, uint8_t length, uint8_t *parity)
+{
+    // Remainder of division by g(x) = (x - 1)(x - a) = x^2 + 3x + 2
+    uint8_t high = 0;
+    uint8_t low = 0;
+
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        uint8_t feedback = data[i] ^ high;
+        high = low ^ _packet_gf_xtime(feedback) ^ feedback;
+        low = _packet_gf_xtime(feedback);
+    }
+
+    parity[0] = high;
+    parity[1] = low;
+}
+#endif
+
+
+bool _packet_rs_correct(uint8_t *data, uint8_t length)
+{
+    // Syndromes s0 = r(1) and s1 = r(a) of the received codeword
+    uint8_t s0 = 0;
+    uint8_t s1 = 0;
+
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        s0 ^= data[i];
+        s1 = _packet_gf_xtime(s1) ^ data[i];
+    }
+
+    if (s0 == 0 && s1 == 0)
+        return true;
+
+    // A single error e at x^p yields s0 = e and s1 = e * a^p
+    if (s0 == 0 || s1 == 0)
+        return false;
+
+    uint8_t syndrome = s0;
+    for (uint8_t p = 0; p < length; ++p)
+    {
+        if (syndrome == s1)
+        {
+            data[length - 1 - p] ^= s0;
+            return true;
+        }
+
+        syndrome = _packet_gf_xtime(syndrome);
+    }
+
+    return false;
+}
+
+
+uint8_t _packet_compute_sum(const uint8_t *data, uint8_t length)
 {
     uint8_t checksum = 0;
 
-    for(uint8_t i = 0; i < EPRO_BLOCK_LENGTH; ++i)
-        checksum = ((uint16_t)checksum + packet->data[i]) % 256;
+    for(uint8_t i = 0; i < length; ++i)
+        checksum = ((uint16_t)checksum + data[i]) % 256;
 
     if (checksum == PACKET_MAGIC_NUMBER)
         checksum++;
 
     return checksum;
 }
+
+
+uint8_t _packet_compute_ack_checksum(const packet_ack_t *ack)
+{
+    const uint8_t *bytes = (const uint8_t*)ack;
+    uint8_t checksum = 0;
+
+    for (uint8_t i = 0; i < sizeof(packet_ack_t) - 1; ++i)
+        checksum = ((uint16_t)checksum + bytes[i]) % 256;
+
+    return checksum;
+}
+
+
+#if EPRO_COBS_FRAMING_ENABLED
+uint8_t _packet_get_frame_length(const uint8_t *data, uint8_t length)
+{
+    // Frame length announced by the header, 0 if the header is incomplete
+    if (length < 2)
+        return 0;
+
+    if ((data[1] & PACKET_VERSION_MASK) != PACKET_VERSION_BINARY)
+        return PACKET_ASCII_FRAME_LENGTH;
+
+    if (data[1] & ~(PACKET_VERSION_MASK | PACKET_FLAGS_SUPPORTED))
+        return 0;
+
+    uint8_t header_length = _packet_get_header_length(data[1]);
+    if (!(data[1] & PACKET_FLAG_LENGTH))
+        return header_length + EPRO_BLOCK_LENGTH + _packet_get_trailer_length(data[1]);
+
+    if (length <= header_length || data[header_length] > EPRO_PACKET_MAX_PAYLOAD)
+        return 0;
+
+    return header_length + 1 + data[header_length] + _packet_get_trailer_length(data[1]);
+}
+
+
+uint8_t _packet_cobs_encode(const uint8_t *src, uint8_t length, uint8_t *dst)
+{
+    // Each code byte holds the distance to the next zero, all output is XORed
+    // with the magic number so it takes the role of zero on the wire
+    uint8_t *code_position = dst;
+    uint8_t *out = dst + 1;
+    uint8_t code = 1;
+
+    for (uint8_t i = 0; i < length; ++i)
+    {
+        if (src[i] != 0)
+        {
+            *out++ = src[i] ^ PACKET_MAGIC_NUMBER;
+            if (++code < 0xff)
+                continue;
+        }
+
+        *code_position = code ^ PACKET_MAGIC_NUMBER;
+        code_position = out++;
+        code = 1;
+    }
+
+    *code_position = code ^ PACKET_MAGIC_NUMBER;
+
+    return out - dst;
+}
+
+
+uint8_t _packet_cobs_decode(uint8_t *data, uint8_t length)
+{
+    const uint8_t *in = data;
+    const uint8_t *end = data + length;
+    uint8_t *out = data;
+
+    while (in < end)
+    {
+        uint8_t code = *in++ ^ PACKET_MAGIC_NUMBER;
+        if (code == 0 || code - 1 > end - in)
+            return 0;
+
+        for (uint8_t i = 1; i < code; ++i)
+            *out++ = *in++ ^ PACKET_MAGIC_NUMBER;
+
+        if (code < 0xff && in < end)
+            *out++ = 0;
+    }
+
+    return out - data;
+}
+#endif
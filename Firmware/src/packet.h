@@ -26,28 +26,203 @@
 
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define PACKET_MAGIC_NUMBER 0xfe
 
+// Version byte following the magic number in binary headers. It is
+// neither a digit nor the magic number, so receivers can tell both
+// header formats apart by looking at the second byte of a frame.
+// The remaining bits carry flags describing the rest of the frame.
+#define PACKET_VERSION_BINARY 0x82
+#define PACKET_VERSION_MASK   0xc2
+
+#define PACKET_FLAG_CRC16  0x01
+#define PACKET_FLAG_LENGTH 0x04
+#define PACKET_FLAG_FEC    0x08
+#define PACKET_FLAG_STREAM 0x10
+#define PACKET_FLAG_ACK    0x20
+
+// Flags the frame buffer is sized for, frames carrying others are dropped
+#define PACKET_FLAGS_SUPPORTED (PACKET_FLAG_CRC16 | PACKET_FLAG_LENGTH \
+                                | (EPRO_FEC_ENABLED ? PACKET_FLAG_FEC : 0) \
+                                | (EPRO_STREAM_COUNT > 1 ? PACKET_FLAG_STREAM : 0) \
+                                | (EPRO_FULL_DUPLEX_ENABLED ? PACKET_FLAG_ACK : 0))
+
+// Wire format v1: magic, ASCII index & total (NUL padded), data, checksum
+#define PACKET_ASCII_FRAME_LENGTH (1 + 3 + 3 + EPRO_BLOCK_LENGTH + 1)
+
+// Wire format v2: magic, version, index & total (16 bit, MSB first), data,
+// checksum or CRC-16 (MSB first) over everything following the magic number.
+// With PACKET_FLAG_LENGTH set a payload length byte follows the total.
+// With PACKET_FLAG_FEC set two RS(n, n-2) parity bytes over everything
+// following the version byte conclude the frame. With PACKET_FLAG_STREAM set
+// a stream id byte follows the total, ahead of the length byte. With
+// PACKET_FLAG_ACK set the next index expected from the other end (16 bit,
+// MSB first) follows the total, ahead of the stream id.
+#define PACKET_BINARY_HEADER_LENGTH (1 + 1 + 2 + 2)
+#define PACKET_BINARY_FRAME_LENGTH  (PACKET_BINARY_HEADER_LENGTH + EPRO_BLOCK_LENGTH + 1)
+
+// COBS framing: magic, stuffed frame body, magic. The body is COBS encoded
+// and XORed with the magic number, so it never contains the magic number.
+// Frames shorter than 254 bytes grow by exactly two bytes.
+#define PACKET_MAX_FRAME_LENGTH (PACKET_BINARY_HEADER_LENGTH + 1 + 1 + EPRO_PACKET_MAX_PAYLOAD + 2 \
+                                 + 2*EPRO_COBS_FRAMING_ENABLED + 2*EPRO_FEC_ENABLED \
+                                 + 2*EPRO_FULL_DUPLEX_ENABLED)
+
+#if EPRO_CRC16_ENABLED && !EPRO_BINARY_HEADER_ENABLED
+#error EPRO_CRC16_ENABLED requires EPRO_BINARY_HEADER_ENABLED!
+#endif
+
+#if EPRO_FEC_ENABLED && !EPRO_BINARY_HEADER_ENABLED
+#error EPRO_FEC_ENABLED requires EPRO_BINARY_HEADER_ENABLED!
+#endif
+
+#if EPRO_PACKET_MAX_PAYLOAD % EPRO_BLOCK_LENGTH != 0 || EPRO_PACKET_MAX_PAYLOAD > 64
+#error EPRO_PACKET_MAX_PAYLOAD must be a multiple of EPRO_BLOCK_LENGTH up to 64!
+#endif
+
+#if EPRO_PACKET_MAX_PAYLOAD > EPRO_BLOCK_LENGTH && !EPRO_BINARY_HEADER_ENABLED
+#error EPRO_PACKET_MAX_PAYLOAD requires EPRO_BINARY_HEADER_ENABLED!
+#endif
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT && EPRO_TRANSPORT_WINDOW_SIZE < 2
+#error EPRO_TRANSPORT_SELECTIVE_REPEAT requires EPRO_TRANSPORT_WINDOW_SIZE > 1!
+#endif
+
+#if EPRO_TRANSPORT_BURST_ENABLED && EPRO_TRANSPORT_WINDOW_SIZE < 2
+#error EPRO_TRANSPORT_BURST_ENABLED requires EPRO_TRANSPORT_WINDOW_SIZE > 1!
+#endif
+
+#if EPRO_STREAM_COUNT > 1 && !EPRO_BINARY_HEADER_ENABLED
+#error EPRO_STREAM_COUNT requires EPRO_BINARY_HEADER_ENABLED!
+#endif
+
+#if EPRO_STREAM_COUNT > 1 && EPRO_TRANSPORT_WINDOW_SIZE > 1
+#error EPRO_STREAM_COUNT requires EPRO_TRANSPORT_WINDOW_SIZE 1!
+#endif
+
+#if EPRO_TRANSPORT_RESUME_ENABLED && EPRO_TRANSPORT_WINDOW_SIZE < 2
+#error EPRO_TRANSPORT_RESUME_ENABLED requires EPRO_TRANSPORT_WINDOW_SIZE > 1!
+#endif
+
+#if EPRO_RX_QUEUE_LENGTH > 127
+#error EPRO_RX_QUEUE_LENGTH must not exceed 127!
+#endif
+
+#if EPRO_MESSAGE_CACHE_SIZE > 0 && EPRO_TRANSPORT_WINDOW_SIZE < 2
+#error EPRO_MESSAGE_CACHE_SIZE requires EPRO_TRANSPORT_WINDOW_SIZE > 1!
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED && !EPRO_BINARY_HEADER_ENABLED
+#error EPRO_FULL_DUPLEX_ENABLED requires EPRO_BINARY_HEADER_ENABLED!
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED && EPRO_TRANSPORT_WINDOW_SIZE > 1
+#error EPRO_FULL_DUPLEX_ENABLED requires EPRO_TRANSPORT_WINDOW_SIZE 1!
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED && EPRO_EXCHANGE_TIMEOUT > 65000
+#error EPRO_EXCHANGE_TIMEOUT must not exceed 65000!
+#endif
+
+// Drivers only queue packets in windowed mode
+#define PACKET_QUEUE_ENABLED (EPRO_TRANSPORT_WINDOW_SIZE > 1 && EPRO_RX_QUEUE_LENGTH > 0)
+
+// Highest packet index that fits into the selected header format
+#if EPRO_BINARY_HEADER_ENABLED
+#define PACKET_MAX_INDEX 0xffff
+#else
+#define PACKET_MAX_INDEX 999
+#endif
+
 typedef struct
 {
-    const uint8_t magic_number;
+    uint16_t index;
+    uint16_t total;
+
+    // Logical stream the packet belongs to, 0 unless sent with epro_send_streams()
+    uint8_t stream;
+
+    // Next index expected from the other end, 0 unless sent with epro_exchange_messages()
+    uint16_t ack;
+
+    uint8_t length;
+    uint8_t data[EPRO_PACKET_MAX_PAYLOAD];
 
-    uint8_t index[3];
-    uint8_t total[3];
+} packet_t;
 
-    uint8_t data[EPRO_BLOCK_LENGTH];
+// Raw frame as sent or received by the interface drivers
+typedef struct
+{
+    uint8_t data[PACKET_MAX_FRAME_LENGTH];
+    uint8_t length;
+    uint8_t position;
+
+} packet_frame_t;
+
+#if PACKET_QUEUE_ENABLED
+// Packets received while nobody is reading, indices run modulo twice the
+// length so full & empty can be told apart. The ISR only moves the tail,
+// the reader only moves the head.
+typedef struct
+{
+    packet_t slots[EPRO_RX_QUEUE_LENGTH];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+
+} packet_queue_t;
+#endif
+
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+#define PACKET_ACK_BITMAP_LENGTH ((EPRO_TRANSPORT_WINDOW_SIZE + 7) / 8)
+#endif
+
+// Cumulative acknowledgement, index is the next packet expected by the receiver,
+// credit the number of packets it can take before the next poll.
+// With selective repeat, bit i of missing is set if packet index + i is missing.
+typedef struct
+{
+    uint8_t code;
+    uint16_t index;
+    uint8_t credit;
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+    uint8_t missing[PACKET_ACK_BITMAP_LENGTH];
+#endif
 
     uint8_t checksum;
 
-} __attribute__((packed)) packet_t;
+} __attribute__((packed)) packet_ack_t;
 
-void packet_init(packet_t *packet, uint8_t index, uint8_t total, const void *data);
+void packet_init(packet_t *packet, uint16_t index, uint16_t total, const void *data, uint8_t length);
 void packet_copy(packet_t *dst, const packet_t *src);
 
-uint8_t packet_get_index(const packet_t *packet);
-uint8_t packet_get_total(const packet_t *packet);
+uint16_t packet_get_index(const packet_t *packet);
+uint16_t packet_get_total(const packet_t *packet);
+uint8_t packet_get_length(const packet_t *packet);
 uint8_t packet_compute_checksum(const packet_t *packet);
+uint16_t packet_compute_crc16(const uint8_t *data, uint8_t length);
+
+void packet_frame_encode(packet_frame_t *frame, const packet_t *packet);
+void packet_frame_decode(const packet_frame_t *frame, packet_t *packet);
+void packet_frame_reset(packet_frame_t *frame);
+bool packet_frame_is_empty(const packet_frame_t *frame);
+bool packet_frame_push(packet_frame_t *frame, uint8_t byte);
+bool packet_frame_is_valid(const packet_frame_t *frame);
+
+void packet_ack_init(packet_ack_t *ack, uint8_t code, uint16_t index, uint8_t credit);
+bool packet_ack_is_valid(const packet_ack_t *ack);
+#if EPRO_TRANSPORT_SELECTIVE_REPEAT
+void packet_ack_set_missing(packet_ack_t *ack, uint8_t offset);
+bool packet_ack_is_missing(const packet_ack_t *ack, uint16_t offset);
+#endif
+
+#if PACKET_QUEUE_ENABLED
+void packet_queue_reset(packet_queue_t *queue);
+bool packet_queue_is_empty(const packet_queue_t *queue);
+bool packet_queue_push(packet_queue_t *queue, const packet_frame_t *frame);
+bool packet_queue_pop(packet_queue_t *queue, packet_t *packet);
+#endif
 
 #endif // EPRO_PACKET_H
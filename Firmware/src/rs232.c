@@ -24,33 +24,111 @@
 #include "rs232.h"
 #include "uart.h"
 
-static const uint32_t bitrates[BITRATE_HINT_COUNT] =
+#if EPRO_RS232_FAST_BAUDRATE > UART_MAX_BAUDRATE
+#error EPRO_RS232_FAST_BAUDRATE exceeds the highest rate possible at this F_CPU!
+
+// Boards sharing F_CPU deviate alike, other devices tolerate a few percent
+#elif UART_ERROR_PERMILLE(EPRO_RS232_FAST_BAUDRATE) > 40
+#warning EPRO_RS232_FAST_BAUDRATE is more than 4% off at this F_CPU!
+#endif
+
+// Address frames take the place of the magic number autobaud is looking for
+#if EPRO_RS232_AUTOBAUD_ENABLED && EPRO_RS232_MULTIDROP_ENABLED
+#error EPRO_RS232_AUTOBAUD_ENABLED and EPRO_RS232_MULTIDROP_ENABLED are exclusive!
+#endif
+
+// A shared line carries one direction at a time
+#if EPRO_FULL_DUPLEX_ENABLED && EPRO_RS232_MULTIDROP_ENABLED
+#error EPRO_FULL_DUPLEX_ENABLED and EPRO_RS232_MULTIDROP_ENABLED are exclusive!
+#endif
+
+// Divisors are computed at compile time, at 8 MHz the achieved rates are
+// 9615 (+0.2%), 12346 (0.0%), 111111 (-3.5%) & 125000 (+1.3%)
+static const uart_divisor_t divisors[BITRATE_HINT_COUNT] =
 {
-    9600,   // BITRATE_HINT_SLOW_STANDARD
-    12345,  // BITRATE_HINT_SLOW_ABERRANT
-    115200, // BITRATE_HINT_FAST_STANDARD
-    123456, // BITRATE_HINT_FAST_ABERRANT
+    UART_DIVISOR(9600),                     // BITRATE_HINT_SLOW_STANDARD
+    UART_DIVISOR(12345),                    // BITRATE_HINT_SLOW_ABERRANT
+    UART_DIVISOR(EPRO_RS232_FAST_BAUDRATE), // BITRATE_HINT_FAST_STANDARD
+    UART_DIVISOR(123456),                   // BITRATE_HINT_FAST_ABERRANT
 };
 
+// Hint the UART is currently configured for, BITRATE_HINT_COUNT if shut down
+static bitrate_hint_t current_hint = BITRATE_HINT_COUNT;
+
 static void _rs232_initialize(bitrate_hint_t hint);
+#if EPRO_RS232_AUTOBAUD_ENABLED
+static void _rs232_initialize_rx(bitrate_hint_t hint);
+#endif
+static void _rs232_shutdown(void);
 
 
 void rs232_alloc_interface(interface_driver_t *interface)
 {
     interface->initialize_tx = _rs232_initialize;
+#if EPRO_RS232_AUTOBAUD_ENABLED
+    interface->initialize_rx = _rs232_initialize_rx;
+#else
     interface->initialize_rx = _rs232_initialize;
-    interface->shutdown      = _uart_shutdown;
+#endif
+    interface->shutdown      = _rs232_shutdown;
 
     interface->send_packet   = _uart_send_packet;
     interface->read_packet   = _uart_read_packet;
     interface->abort         = _uart_abort;
 
+    interface->send_ack      = _uart_send_ack;
+    interface->read_ack      = _uart_read_ack;
+    interface->process       = _uart_process;
+#if EPRO_FULL_DUPLEX_ENABLED
+    interface->post_packet   = _uart_post_packet;
+    interface->fetch_packet  = _uart_fetch_packet;
+#endif
+
     interface->status        = &_uart_status;
 }
 
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+void rs232_set_bus_addresses(uint8_t address, uint8_t peer)
+{
+    _uart_set_bus_addresses(address, peer);
+}
+#endif
+
+
 void _rs232_initialize(bitrate_hint_t hint)
 {
+    // UART already configured, only reset transfer state
+    if (hint == current_hint)
+    {
+        _uart_abort();
+        return;
+    }
+
     _uart_initialize();
-    _uart_set_baudrate(bitrates[hint]);
+    _uart_set_divisor(&divisors[hint]);
+#if EPRO_RS232_MULTIDROP_ENABLED
+    _uart_enable_multidrop();
+#endif
+    current_hint = hint;
+}
+
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+void _rs232_initialize_rx(bitrate_hint_t hint)
+{
+    // The hint only applies until the sender's rate has been measured
+    _rs232_initialize(hint);
+    _uart_start_autobaud();
+
+    // UART no longer runs at the hint's rate, the next call reprograms it
+    current_hint = BITRATE_HINT_COUNT;
+}
+#endif
+
+
+void _rs232_shutdown()
+{
+    _uart_shutdown();
+    current_hint = BITRATE_HINT_COUNT;
 }
@@ -28,4 +28,8 @@
 
 void rs232_alloc_interface(interface_driver_t *interface);
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+void rs232_set_bus_addresses(uint8_t address, uint8_t peer);
+#endif
+
 #endif // EPRO_RS232_H
@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+
+# Host simulation of goodput with & without the Reed-Solomon parity of
+# packet.c. Frames use the binary header with the additive checksum or the
+# CRC-16, every byte but the magic number is corrupted independently with
+# probability p, as is the 1 byte acknowledgement. Frames with a corrupted
+# version byte are counted as lost, the receiver cannot size them. Errors
+# come in bursts on real IrDA links, which this model does not capture.
+#
+# Goodput is payload bytes delivered over bytes on the wire, a message
+# fails once a packet has used up its attempts.
+
+import random
+import sys
+
+BLOCK_LENGTH = 8
+PACKETS_PER_MESSAGE = 12
+ERROR_RATES = (0, 0.001, 0.005, 0.01, 0.02, 0.05)
+
+MAGIC_NUMBER = 0xfe
+VERSION_BINARY = 0x82
+FLAG_CRC16 = 0x01
+FLAG_FEC = 0x08
+
+if len(sys.argv) > 3:
+    print("Usage: %s [messages [attempts]]" % sys.argv[0])
+    sys.exit(2)
+
+messages = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+attempts = int(sys.argv[2]) if len(sys.argv) > 2 else 2
+
+
+def xtime(value):
+    # Multiplication by a = 2 in GF(256), polynomial 0x11d
+    value <<= 1
+    return (value ^ 0x11d) if value & 0x100 else value
+
+
+def rs_encode(data):
+    high = low = 0
+    for byte in data:
+        feedback = byte ^ high
+        high = low ^ xtime(feedback) ^ feedback
+        low = xtime(feedback)
+    return [high, low]
+
+
+def rs_correct(data):
+    s0 = s1 = 0
+    for byte in data:
+        s0 ^= byte
+        s1 = xtime(s1) ^ byte
+
+    if s0 == 0 or s1 == 0:
+        return
+
+    syndrome = s0
+    for p in range(len(data)):
+        if syndrome == s1:
+            data[len(data) - 1 - p] ^= s0
+            return
+        syndrome = xtime(syndrome)
+
+
+def crc16(data):
+    crc = 0xffff
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        crc &= 0xffff
+    return crc
+
+
+def checksum(data):
+    value = sum(data) % 256
+    return value + 1 if value == MAGIC_NUMBER else value
+
+
+def encode(version, index, total, data):
+    frame = [MAGIC_NUMBER, version, index >> 8, index & 0xff, total >> 8, total & 0xff] + data
+    if version & FLAG_CRC16:
+        crc = crc16(frame[1:])
+        frame += [crc >> 8, crc & 0xff]
+    else:
+        frame.append(checksum(data))
+    if version & FLAG_FEC:
+        frame += rs_encode(frame[2:])
+    return frame
+
+
+def decode(frame, version):
+    # Returns the data block of a frame passing the check, None otherwise
+    if frame[1] != version:
+        return None
+
+    if version & FLAG_FEC:
+        body = frame[2:]
+        rs_correct(body)
+        frame = frame[:2] + body[:-2]
+
+    data = frame[6:6 + BLOCK_LENGTH]
+    if version & FLAG_CRC16:
+        crc = crc16(frame[1:-2])
+        valid = (frame[-2] == crc >> 8 and frame[-1] == crc & 0xff)
+    else:
+        valid = (frame[-1] == checksum(data))
+
+    return data if valid else None
+
+
+def corrupt(rng, frame, p):
+    return [b ^ rng.randint(1, 255) if i > 0 and rng.random() < p else b
+            for i, b in enumerate(frame)]
+
+
+def simulate(rng, version, p):
+    wire = good = undetected = succeeded = 0
+
+    for _ in range(messages):
+        ok = True
+        for index in range(1, PACKETS_PER_MESSAGE + 1):
+            data = [rng.randint(0, 255) for _ in range(BLOCK_LENGTH)]
+            frame = encode(version, index, PACKETS_PER_MESSAGE, data)
+
+            delivered = False
+            for _ in range(attempts):
+                wire += len(frame) + 1
+                received = decode(corrupt(rng, frame, p), version)
+                if received is not None and rng.random() >= p:
+                    delivered = True
+                    undetected += (received != data)
+                    break
+
+            if not delivered:
+                ok = False
+                break
+            good += BLOCK_LENGTH
+
+        succeeded += ok
+
+    return good / wire, succeeded / messages, undetected
+
+
+rng = random.Random(1)
+variants = (("sum", VERSION_BINARY),
+            ("sum+FEC", VERSION_BINARY | FLAG_FEC),
+            ("CRC", VERSION_BINARY | FLAG_CRC16),
+            ("CRC+FEC", VERSION_BINARY | FLAG_CRC16 | FLAG_FEC))
+
+print("%d messages of %d packets, %d attempts per packet" % (messages, PACKETS_PER_MESSAGE, attempts))
+print("goodput / message success / undetected errors")
+print("%-6s" % "p" + "".join("%24s" % name for name, _ in variants))
+for p in ERROR_RATES:
+    line = "%-6g" % p
+    for _, version in variants:
+        line += "%10.3f %7.3f %5d" % simulate(rng, version, p)
+    print(line)
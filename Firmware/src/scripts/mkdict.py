@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+
+# Builds the static dictionary used by compress.c from a message file and
+# prints it as a C table, followed by the packet counts with & without
+# compression. Paste the table into compress.c when the dictionary changes,
+# sender & receiver have to use the same one.
+
+import collections
+import sys
+
+DICTIONARY_SIZE = 128
+WORD_LENGTH = 8
+BLOCK_LENGTH = 8
+
+if len(sys.argv) != 2:
+    print("Usage: %s msgfile" % sys.argv[0])
+    sys.exit(2)
+
+# Read msgfile
+try:
+    msgfile = open(sys.argv[1], 'r')
+except:
+    sys.exit("Couldn't open file %s." % sys.argv[1])
+
+messages = [m.strip() for m in msgfile.readlines()]
+messages = list(filter(None, messages))
+msgfile.close()
+
+if len(messages) < 1:
+    sys.exit("No messages found.")
+
+
+def literal_runs(symbols):
+    # Substrings may not span words already in the dictionary
+    run = ''
+    for s in symbols:
+        if s is None:
+            if run:
+                yield run
+            run = ''
+        else:
+            run += s
+    if run:
+        yield run
+
+
+def replace(symbols, word):
+    i = 0
+    while i + len(word) <= len(symbols):
+        if None not in symbols[i:i+len(word)] and ''.join(symbols[i:i+len(word)]) == word:
+            symbols[i:i+len(word)] = [None]
+        i += 1
+
+
+# Pick the substring saving the most bytes, replace it & repeat
+words = []
+texts = [list(m) for m in messages]
+
+while len(words) < DICTIONARY_SIZE:
+    counts = collections.Counter()
+    for t in texts:
+        for run in literal_runs(t):
+            for length in range(2, WORD_LENGTH + 1):
+                for i in range(len(run) - length + 1):
+                    counts[run[i:i+length]] += 1
+
+    if not counts:
+        break
+
+    best = max(counts, key=lambda w: counts[w] * (len(w) - 1) - len(w))
+    if counts[best] * (len(best) - 1) - len(best) <= 0:
+        break
+
+    words.append(best)
+    for t in texts:
+        replace(t, best)
+
+
+def compressed_length(message):
+    # Same greedy longest match as compress_string(), including the NUL
+    length = 0
+    i = 0
+    while i < len(message):
+        match = 1
+        for w in words:
+            if len(w) > match and message.startswith(w, i):
+                match = len(w)
+        length += 1
+        i += match
+    return length + 1
+
+
+def packet_count(length, payload):
+    # The message header takes two blocks
+    blocks = (length + BLOCK_LENGTH - 1) // BLOCK_LENGTH + 2
+    per_packet = payload // BLOCK_LENGTH
+    return (blocks + per_packet - 1) // per_packet
+
+
+# Print table
+print("#define _COMPRESS_DICTIONARY_SIZE %d\n" % len(words))
+print("static const char _compress_dictionary[_COMPRESS_DICTIONARY_SIZE][COMPRESS_WORD_LENGTH + 1] PROGMEM =")
+print("{")
+for w in words:
+    print('    "%s",' % w.replace('\\', '\\\\').replace('"', '\\"'))
+print("};\n")
+
+# Print benchmark
+print("// %d messages, %d bytes" % (len(messages), sum(len(m) for m in messages)))
+print("// compressed: %d bytes" % sum(compressed_length(m) for m in messages))
+for payload in (8, 32, 64):
+    plain = sum(packet_count(len(m), payload) for m in messages)
+    packed = sum(packet_count(compressed_length(m), payload) for m in messages)
+    print("// packets at %d byte payload: %d -> %d (%.0f%%)" % (payload, plain, packed, 100.0 * (packed - plain) / plain))
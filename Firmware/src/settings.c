@@ -21,6 +21,7 @@
 //                                                                                                //
 // ============================================================================================== //
 
+#include "benchmark.h"
 #include "epro.h"
 #include "lcd.h"
 #include "messagetable.h"
@@ -43,6 +44,11 @@ static uint8_t eep_message_key[EPRO_BLOCK_LENGTH] EEMEM = EPRO_DEFAULT_MESSAGE_K
 static uint8_t eep_debug EEMEM = EPRO_DEFAULT_DEBUG ? 1 : 0;
 static uint8_t eep_pin[EPRO_PIN_LENGTH] EEMEM = EPRO_DEFAULT_PIN;
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+static uint8_t eep_bus_address EEMEM = EPRO_DEFAULT_BUS_ADDRESS;
+static uint8_t eep_bus_peer EEMEM = EPRO_DEFAULT_BUS_PEER;
+#endif
+
 #if EPRO_DEVICE_LOCK_ENABLED
 static uint8_t eep_locked EEMEM = 0;
 #endif
@@ -67,6 +73,11 @@ static void _settings_read_debug(bool *debug);
 static void _settings_write_pin(const uint8_t *pin);
 static void _settings_read_pin(uint8_t *pin);
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+static void _settings_write_bus_addresses(uint8_t address, uint8_t peer);
+static void _settings_read_bus_addresses(uint8_t *address, uint8_t *peer);
+#endif
+
 #if EPRO_DEVICE_LOCK_ENABLED
 static void _settings_write_locked(bool locked);
 static void _settings_read_locked(bool *locked);
@@ -75,6 +86,9 @@ static void _settings_read_locked(bool *locked);
 
 // Helper
 static bool _settings_check_pin(void);
+#if EPRO_RS232_MULTIDROP_ENABLED
+static bool _settings_input_bus_address(const char *caption, uint8_t *address);
+#endif
 
 
 // Interface menu
@@ -100,17 +114,29 @@ static void _settings_set_test_message(void);
 static void _settings_set_key(void);
 static void _settings_toggle_debug(void);
 static void _settings_change_pin(void);
+#if EPRO_RS232_MULTIDROP_ENABLED
+static void _settings_set_bus_addresses(void);
+#endif
 
 static const menu_entry_t admin_menu_entries[] =
 {
-    { "Select message", _settings_select_message   },
-    { "Set test msg",   _settings_set_test_message },
-    { "Set key",        _settings_set_key          },
-    { "Toggle debug",   _settings_toggle_debug     },
-    { "Change PIN",     _settings_change_pin       }
+    { "Select message", _settings_select_message    },
+    { "Set test msg",   _settings_set_test_message  },
+    { "Set key",        _settings_set_key           },
+    { "Toggle debug",   _settings_toggle_debug      },
+    { "Change PIN",     _settings_change_pin        },
+#if EPRO_RS232_MULTIDROP_ENABLED
+    { "Bus address",    _settings_set_bus_addresses },
+#endif
+    { "Benchmark",      benchmark_run               },
+    { "Throughput",     benchmark_run_throughput    }
 };
 
-MENU_INIT(admin_menu, "Administration:", 5, admin_menu_entries, false);
+#if EPRO_RS232_MULTIDROP_ENABLED
+MENU_INIT(admin_menu, "Administration:", 8, admin_menu_entries, false);
+#else
+MENU_INIT(admin_menu, "Administration:", 7, admin_menu_entries, false);
+#endif
 
 
 // Settings menu
@@ -134,6 +160,10 @@ void settings_save(const settings_t *settings)
     _settings_write_message_key(settings->message_key);
     _settings_write_debug(settings->debug);
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+    _settings_write_bus_addresses(settings->bus_address, settings->bus_peer);
+#endif
+
 #if EPRO_DEVICE_LOCK_ENABLED
     _settings_write_locked(settings->locked);
 #endif
@@ -148,6 +178,10 @@ void settings_load(settings_t *settings)
     _settings_read_message_key(settings->message_key);
     _settings_read_debug(&settings->debug);
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+    _settings_read_bus_addresses(&settings->bus_address, &settings->bus_peer);
+#endif
+
 #if EPRO_DEVICE_LOCK_ENABLED
     _settings_read_locked(&settings->locked);
 #endif
@@ -265,6 +299,27 @@ void _settings_read_pin(uint8_t *pin)
 }
 
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+void _settings_write_bus_addresses(uint8_t address, uint8_t peer)
+{
+    eeprom_write_byte(&eep_bus_address, address);
+    eeprom_write_byte(&eep_bus_peer, peer);
+}
+
+
+void _settings_read_bus_addresses(uint8_t *address, uint8_t *peer)
+{
+    *address = eeprom_read_byte(&eep_bus_address);
+    if (*address == 0xff)
+        *address = EPRO_DEFAULT_BUS_ADDRESS;
+
+    *peer = eeprom_read_byte(&eep_bus_peer);
+    if (*peer == 0xff)
+        *peer = EPRO_DEFAULT_BUS_PEER;
+}
+#endif
+
+
 #if EPRO_DEVICE_LOCK_ENABLED
 void _settings_write_locked(bool locked)
 {
@@ -316,6 +371,30 @@ bool _settings_check_pin()
 }
 
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+bool _settings_input_bus_address(const char *caption, uint8_t *address)
+{
+    uint8_t input[3] = { '0' + *address / 100, '0' + *address / 10 % 10, '0' + *address % 10 };
+    if (!epro_get_input(caption, input, 3, true))
+        return false;
+
+    // 0xff reads back as blank EEPROM
+    uint16_t value = (input[0] - '0') * 100 + (input[1] - '0') * 10 + (input[2] - '0');
+    if (value > 254)
+    {
+        lcd_clear();
+        lcd_printf_PSTR(0, "Address must be");
+        lcd_printf_PSTR(1, "0 to 254!");
+        epro_delay_ms(2000);
+        return false;
+    }
+
+    *address = (uint8_t)value;
+    return true;
+}
+#endif
+
+
 void _settings_select_rs232()
 {
     epro_select_interface(INTERFACE_RS232);
@@ -548,6 +627,28 @@ void _settings_change_pin()
 }
 
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+void _settings_set_bus_addresses()
+{
+    uint8_t address, peer;
+    _settings_read_bus_addresses(&address, &peer);
+
+    if (!_settings_input_bus_address("Own address:", &address))
+        return;
+
+    if (!_settings_input_bus_address("Send to address:", &peer))
+        return;
+
+    _settings_write_bus_addresses(address, peer);
+    epro_set_bus_addresses(address, peer);
+
+    lcd_clear();
+    lcd_printf_PSTR(0, "Address set.");
+    epro_delay_ms(1000);
+}
+#endif
+
+
 void _settings_select_interface()
 {
     _settings_read_interface_index(&interface_menu.current_entry);
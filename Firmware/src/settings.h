@@ -36,6 +36,11 @@ typedef struct
     uint8_t message_key[EPRO_BLOCK_LENGTH];
     bool debug;
 
+#if EPRO_RS232_MULTIDROP_ENABLED
+    uint8_t bus_address;
+    uint8_t bus_peer;
+#endif
+
 #if EPRO_DEVICE_LOCK_ENABLED
     bool locked;
 #endif
@@ -26,6 +26,7 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include <string.h>
@@ -36,6 +37,7 @@ typedef enum
     _SPI_MODE_PACKET_RX,
     _SPI_MODE_ACK_TX,
     _SPI_MODE_ACK_RX,
+    _SPI_MODE_POLL_TX,
     _SPI_MODE_IDLE
 
 } _spi_mode_t;
@@ -43,24 +45,49 @@ typedef enum
 
 static volatile _spi_mode_t mode = _SPI_MODE_IDLE;
 static volatile uint8_t ack = ASCII_NACK;
+static volatile bool immediate_ack = true;
 
-static uint8_t packet_buffer[sizeof(packet_t)];
-static uint8_t packet_buffer_position = 0;
+static packet_frame_t frame;
 
 static packet_t *current_packet = 0;
 
+static uint8_t ack_buffer[sizeof(packet_ack_t)];
+static uint8_t ack_buffer_position = 0;
+
+static packet_ack_t *current_ack = 0;
+
+// Set by the interrupt handler when the slave needs time before the next
+// byte, which _spi_process() sends outside the handler
+static volatile bool byte_pending = false;
+static volatile uint8_t pending_byte = 0x00;
+
+#if PACKET_QUEUE_ENABLED
+static packet_queue_t queue;
+
+// Poll received while packets were queued, answered once they are handed over
+static volatile bool poll_pending = false;
+#endif
+
 static interface_status_t status;
 
+// Hints the SPI is currently configured for, BITRATE_HINT_COUNT if not
+static bitrate_hint_t tx_hint = BITRATE_HINT_COUNT;
+static bitrate_hint_t rx_hint = BITRATE_HINT_COUNT;
+
 
 // Driver functions
 static void _spi_initialize_tx(bitrate_hint_t hint);
 static void _spi_initialize_rx(bitrate_hint_t hint);
 static void _spi_shutdown(void);
 
-static void _spi_send_packet(const packet_t *packet);
-static void _spi_read_packet(packet_t *packet);
+static void _spi_send_packet(const packet_t *packet, bool immediate);
+static void _spi_read_packet(packet_t *packet, bool immediate);
 static void _spi_abort(void);
 
+static void _spi_send_ack(const packet_ack_t *ack);
+static void _spi_read_ack(packet_ack_t *ack);
+static void _spi_process(void);
+
 // Private functions
 static void _spi_enable_interrupt(void);
 static void _spi_disable_interrupt(void);
@@ -73,15 +100,24 @@ ISR(SPI_STC_vect)
     {
         case _SPI_MODE_PACKET_TX:
         {
-            if (packet_buffer_position < sizeof(packet_t))
-                SPDR = packet_buffer[packet_buffer_position++];
+            if (frame.position < frame.length)
+                SPDR = frame.data[frame.position++];
+            else if (!immediate_ack)
+            {
+                // Windowed mode, the next packet follows right away
+                _spi_disable_interrupt();
+                mode = _SPI_MODE_IDLE;
+
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
             else
             {
                 mode = _SPI_MODE_ACK_RX;
 
-                // Give slave some time & read confirmation
-                _delay_us(200);
-                SPDR = 0x00;
+                // Read confirmation from _spi_process()
+                pending_byte = 0x00;
+                byte_pending = true;
             }
 
             break;
@@ -89,20 +125,56 @@ ISR(SPI_STC_vect)
 
         case _SPI_MODE_PACKET_RX:
         {
-            if (packet_buffer_position >= sizeof(packet_t))
-                return;
-
             uint8_t byte = SPDR;
-            if (byte == PACKET_MAGIC_NUMBER)
-                packet_buffer_position = 0;
+            status.active = true;
 
-            packet_buffer[packet_buffer_position++] = byte;
-            if (packet_buffer_position >= sizeof(packet_t))
+            // In windowed mode the master polls for an acknowledgement between packets
+            if (!immediate_ack && byte == ASCII_ENQ && packet_frame_is_empty(&frame))
             {
-                // Compute & verify checksum
-                packet_t *packet = (packet_t*)packet_buffer;
-                uint8_t checksum = packet_compute_checksum(packet);
-                ack = (checksum == packet->checksum) ? ASCII_ACK : ASCII_NACK;
+                mode = _SPI_MODE_IDLE;
+
+#if PACKET_QUEUE_ENABLED
+                if (!packet_queue_is_empty(&queue))
+                {
+                    poll_pending = true;
+                    break;
+                }
+#endif
+
+                status.ack_requested = true;
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+                break;
+            }
+
+            bool complete = packet_frame_push(&frame, byte);
+            if (complete && !immediate_ack)
+            {
+                // Hand over valid packets and keep listening, packets arriving
+                // before the next call to _spi_read_packet() are queued if possible
+                if (current_packet)
+                {
+                    bool valid = packet_frame_is_valid(&frame);
+                    if (valid)
+                        packet_frame_decode(&frame, current_packet);
+
+                    current_packet = 0;
+
+                    status.result = valid ? RESULT_SUCCESS : RESULT_FAILED;
+                    status.done = true;
+                }
+#if PACKET_QUEUE_ENABLED
+                else
+                    packet_queue_push(&queue, &frame);
+#endif
+
+                packet_frame_reset(&frame);
+                SPDR = 0x00;
+            }
+            else if (complete)
+            {
+                // Verify checksum
+                ack = packet_frame_is_valid(&frame) ? ASCII_ACK : ASCII_NACK;
 
                 mode = _SPI_MODE_ACK_TX;
 
@@ -117,12 +189,30 @@ ISR(SPI_STC_vect)
 
         case _SPI_MODE_ACK_TX:
         {
+            if (!immediate_ack)
+            {
+                // The master keeps clocking until it sees the first byte
+                if (ack_buffer_position < sizeof(packet_ack_t))
+                    SPDR = ack_buffer[ack_buffer_position++];
+                else
+                {
+                    packet_frame_reset(&frame);
+                    mode = _SPI_MODE_PACKET_RX;
+                    SPDR = 0x00;
+
+                    status.result = RESULT_SUCCESS;
+                    status.done = true;
+                }
+
+                break;
+            }
+
             _spi_disable_interrupt();
             mode = _SPI_MODE_IDLE;
             
             if (ack == ASCII_ACK && current_packet)
             {
-                memcpy(current_packet, packet_buffer, sizeof(packet_t));
+                packet_frame_decode(&frame, current_packet);
                 current_packet = 0;
             }
 
@@ -132,8 +222,53 @@ ISR(SPI_STC_vect)
             break;
         }
 
+        case _SPI_MODE_POLL_TX:
+        {
+            uint8_t byte = SPDR;
+            if (byte == ASCII_ACK || byte == ASCII_NACK)
+            {
+                ack_buffer[0] = byte;
+                ack_buffer_position = 1;
+                mode = _SPI_MODE_ACK_RX;
+
+                _delay_us(20);
+                SPDR = 0x00;
+            }
+            else
+            {
+                // Slave not ready yet, poll again from _spi_process()
+                pending_byte = ASCII_ENQ;
+                byte_pending = true;
+            }
+
+            break;
+        }
+
         case _SPI_MODE_ACK_RX:
         {
+            if (!immediate_ack)
+            {
+                ack_buffer[ack_buffer_position++] = SPDR;
+                if (ack_buffer_position < sizeof(packet_ack_t))
+                {
+                    _delay_us(20);
+                    SPDR = 0x00;
+                    break;
+                }
+
+                _spi_disable_interrupt();
+                mode = _SPI_MODE_IDLE;
+
+                memcpy(current_ack, ack_buffer, sizeof(packet_ack_t));
+                current_ack = 0;
+
+                status.result = packet_ack_is_valid((packet_ack_t*)ack_buffer) ? RESULT_SUCCESS
+                                                                               : RESULT_FAILED;
+                status.done = true;
+
+                break;
+            }
+
             ack = SPDR;
 
             _spi_disable_interrupt();
@@ -161,12 +296,27 @@ void spi_alloc_interface(interface_driver_t *interface)
     interface->read_packet   = _spi_read_packet;
     interface->abort         = _spi_abort;
 
+    interface->send_ack      = _spi_send_ack;
+    interface->read_ack      = _spi_read_ack;
+    interface->process       = _spi_process;
+#if EPRO_FULL_DUPLEX_ENABLED
+    interface->post_packet   = 0;
+    interface->fetch_packet  = 0;
+#endif
+
     interface->status        = &status;
 }
 
 
 void _spi_initialize_tx(bitrate_hint_t hint)
 {
+    // Already configured, only reset transfer state
+    if (hint == tx_hint)
+    {
+        _spi_abort();
+        return;
+    }
+
     // Set ^SS, MOSI and SCK to output, MISO to input
     DDRB |= (1<<DDB4) | (1<<DDB5) | (1<<DDB7);
     DDRB &= ~(1<<DDB6);
@@ -176,6 +326,7 @@ void _spi_initialize_tx(bitrate_hint_t hint)
 
     // Enable SPI & select master mode
     SPCR = (1<<SPE) | (1<<MSTR);
+    byte_pending = false;
 
     // Set clock rate, see ATmega32 datasheet page 137
     switch (hint)
@@ -193,20 +344,40 @@ void _spi_initialize_tx(bitrate_hint_t hint)
 
     // Clear SPI interrupt flag
     SPSR; SPDR;
+
+    mode = _SPI_MODE_IDLE;
+    status.ack_requested = false;
+
+    tx_hint = hint;
+    rx_hint = BITRATE_HINT_COUNT;
 }
 
 
 void _spi_initialize_rx(bitrate_hint_t hint)
 {
+    // Already configured, only reset transfer state
+    if (hint == rx_hint)
+    {
+        _spi_abort();
+        return;
+    }
+
     // Set MISO to output, others to input
     DDRB |= (1<<DDB6);
     DDRB &= ~((1<<DDB4) | (1<<DDB5) | (1<<DDB7));
 
     // Enable SPI, slave mode is default (MSTR = 0)
     SPCR = (1<<SPE);
+    byte_pending = false;
 
     // Clear SPI interrupt flag
     SPSR; SPDR;
+
+    mode = _SPI_MODE_IDLE;
+    status.ack_requested = false;
+
+    tx_hint = BITRATE_HINT_COUNT;
+    rx_hint = hint;
 }
 
 
@@ -214,14 +385,17 @@ void _spi_shutdown()
 {
     // Disable SPI
     SPCR = 0x00;
+
+    tx_hint = BITRATE_HINT_COUNT;
+    rx_hint = BITRATE_HINT_COUNT;
 }
 
 
-void _spi_send_packet(const packet_t *packet)
+void _spi_send_packet(const packet_t *packet, bool immediate)
 {
-    // Initialize packet buffer
-    memcpy(packet_buffer, packet, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // Initialize frame buffer
+    packet_frame_encode(&frame, packet);
+    immediate_ack = immediate;
     mode = _SPI_MODE_PACKET_TX;
 
     // Start transmission
@@ -235,12 +409,63 @@ void _spi_send_packet(const packet_t *packet)
 }
 
 
-void _spi_read_packet(packet_t *packet)
+void _spi_read_packet(packet_t *packet, bool immediate)
 {
-    // Initialize packet_buffer
-    memset(packet_buffer, 0, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // A pending acknowledgement request needs to be answered first
+    if (status.ack_requested)
+        return;
+
+#if PACKET_QUEUE_ENABLED
+    // Hand over queued packets first, then answer a deferred poll
+    if (!immediate && !immediate_ack && (mode == _SPI_MODE_PACKET_RX || poll_pending))
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            status.result = RESULT_FAILED;
+            status.done = false;
+
+            if (packet_queue_pop(&queue, packet))
+            {
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
+            else if (poll_pending)
+            {
+                poll_pending = false;
+
+                status.ack_requested = true;
+                status.result = RESULT_SUCCESS;
+                status.done = true;
+            }
+            else
+            {
+                // Already listening, keep partially received packet
+                current_packet = packet;
+            }
+        }
+
+        return;
+    }
+#else
+    // Already listening in windowed mode, keep partially received packet
+    if (!immediate && !immediate_ack && mode == _SPI_MODE_PACKET_RX)
+    {
+        status.result = RESULT_FAILED;
+        status.done = false;
+        current_packet = packet;
+        return;
+    }
+#endif
+
+    immediate_ack = immediate;
+
+    // Initialize frame buffer
+    packet_frame_reset(&frame);
     mode = _SPI_MODE_PACKET_RX;
+#if PACKET_QUEUE_ENABLED
+    packet_queue_reset(&queue);
+    poll_pending = false;
+#endif
 
     // Start transmission
     status.result = RESULT_FAILED;
@@ -256,7 +481,58 @@ void _spi_read_packet(packet_t *packet)
 void _spi_abort()
 {
     _spi_disable_interrupt();
+    byte_pending = false;
     mode = _SPI_MODE_IDLE;
+    status.ack_requested = false;
+#if PACKET_QUEUE_ENABLED
+    poll_pending = false;
+#endif
+}
+
+
+void _spi_send_ack(const packet_ack_t *ack)
+{
+    // Bytes are loaded by the interrupt handler while the master is polling
+    memcpy(ack_buffer, ack, sizeof(packet_ack_t));
+    ack_buffer_position = 0;
+    immediate_ack = false;
+    mode = _SPI_MODE_ACK_TX;
+
+    status.ack_requested = false;
+    status.result = RESULT_FAILED;
+    status.done = false;
+}
+
+
+void _spi_read_ack(packet_ack_t *ack)
+{
+    // Initialize ack buffer
+    memset(ack_buffer, 0, sizeof(packet_ack_t));
+    ack_buffer_position = 0;
+    immediate_ack = false;
+    mode = _SPI_MODE_POLL_TX;
+
+    // Start transmission
+    status.result = RESULT_FAILED;
+    status.done = false;
+    current_ack = ack;
+
+    _spi_enable_interrupt();
+
+    // Send poll request
+    SPDR = ASCII_ENQ;
+}
+
+
+void _spi_process()
+{
+    if (!byte_pending)
+        return;
+
+    // Give slave some time
+    _delay_us(200);
+    byte_pending = false;
+    SPDR = pending_byte;
 }
 
 
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define ASCII_ENQ  0x05
 #define ASCII_ACK  0x06
 #define ASCII_NACK 0x15
 
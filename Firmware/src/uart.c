@@ -21,19 +21,19 @@
 //                                                                                                //
 // ============================================================================================== //
 
+
 #include "config.h"
 #include "uart.h"
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
 
+#include <util/atomic.h>
 #include <util/delay.h>
 
+#include <stdlib.h>
 #include <string.h>
 
-// 500000 baud is the highest rate possible, equals ubrr = 0
-#define MAX_BAUDRATE 500000L
-
 #define _UART_PIN_RXD 0
 #define _UART_PIN_TXD 1
 
@@ -43,6 +43,33 @@
 #define _UART_PIN_IR_ENABLE 5
 #endif
 
+// Ring buffer indices are free running 8 bit counters
+#if (EPRO_UART_TX_BUFFER_SIZE & (EPRO_UART_TX_BUFFER_SIZE - 1)) || EPRO_UART_TX_BUFFER_SIZE > 128
+#error EPRO_UART_TX_BUFFER_SIZE must be a power of two up to 128!
+#endif
+
+#if (EPRO_UART_RX_BUFFER_SIZE & (EPRO_UART_RX_BUFFER_SIZE - 1)) || EPRO_UART_RX_BUFFER_SIZE > 128
+#error EPRO_UART_RX_BUFFER_SIZE must be a power of two up to 128!
+#endif
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+// Rates autobaud can measure, in CPU cycles per byte (10 bits). Faster rates
+// suffer from the few cycles polling the pin takes, slower ones would
+// overflow Timer1.
+#define _UART_AUTOBAUD_MIN_CYCLES (10 * F_CPU / 125000)
+#define _UART_AUTOBAUD_MAX_CYCLES (10 * F_CPU / 2400)
+
+// Cycles spent waiting for a start bit per call
+#define _UART_AUTOBAUD_TIMEOUT (F_CPU / 2000)
+
+// Edges are polled with interrupts disabled for at most this many cycles at a
+// time, so timer ticks & received bytes are served in between
+#define _UART_AUTOBAUD_SLICE (F_CPU / 10000)
+
+// Invalid frames in a row before the rate is measured again
+#define _UART_AUTOBAUD_MAX_ERRORS 3
+#endif
+
 interface_status_t _uart_status;
 
 typedef enum
@@ -51,132 +78,292 @@ typedef enum
     UART_MODE_PACKET_RX,
     UART_MODE_ACK_TX,
     UART_MODE_ACK_RX,
+    UART_MODE_POLL_TX,
+    UART_MODE_AUTOBAUD,
+    UART_MODE_DUPLEX,
     UART_MODE_IDLE
 
 } _uart_mode_t;
 
+#if EPRO_RS232_AUTOBAUD_ENABLED
+typedef enum
+{
+    UART_AUTOBAUD_OFF,
+    UART_AUTOBAUD_SEARCH,
+    UART_AUTOBAUD_SETTLE,
+    UART_AUTOBAUD_LOCKED
+
+} _uart_autobaud_t;
+#endif
+
+// Byte FIFO between the interrupt handlers and _uart_process(). Only the
+// consumer moves the head and only the producer moves the tail.
+typedef struct
+{
+    uint8_t *data;
+    uint8_t mask;
+    volatile uint8_t head;
+    volatile uint8_t tail;
+
+} _uart_ring_t;
 
-static volatile _uart_mode_t mode = UART_MODE_IDLE;
-static volatile uint8_t ack = ASCII_NACK;
-static volatile bool ack_sent = false;
 
-static uint8_t packet_buffer[sizeof(packet_t)];
-static uint8_t packet_buffer_position = 0;
+static uint8_t tx_data[EPRO_UART_TX_BUFFER_SIZE];
+static uint8_t rx_data[EPRO_UART_RX_BUFFER_SIZE];
+
+static _uart_ring_t tx_ring = { tx_data, EPRO_UART_TX_BUFFER_SIZE - 1, 0, 0 };
+static _uart_ring_t rx_ring = { rx_data, EPRO_UART_RX_BUFFER_SIZE - 1, 0, 0 };
+
+// Bytes still to be put into the transmit buffer
+static const uint8_t *tx_source = 0;
+static uint8_t tx_length = 0;
+static uint8_t tx_position = 0;
+
+// Set while transmitted bytes may still be shifting out
+static bool tx_active = false;
+
+#if EPRO_RS232_MULTIDROP_ENABLED
+static bool multidrop = false;
+static uint8_t bus_address = EPRO_DEFAULT_BUS_ADDRESS;
+static uint8_t bus_peer = EPRO_DEFAULT_BUS_PEER;
+
+// Set until the address frame of the current transmission has been sent
+static volatile bool tx_address = false;
+#endif
+
+static _uart_mode_t mode = UART_MODE_IDLE;
+static uint8_t ack = ASCII_NACK;
+static bool immediate_ack = true;
+
+static packet_frame_t frame;
 
 static packet_t *current_packet = 0;
 
+static uint8_t ack_buffer[sizeof(packet_ack_t)];
+static uint8_t ack_buffer_position = 0;
+
+static packet_ack_t *current_ack = 0;
+
+#if PACKET_QUEUE_ENABLED
+static packet_queue_t queue;
+
+// Poll received while packets were queued, answered once they are handed over
+static bool poll_pending = false;
+#endif
+
+#if EPRO_FULL_DUPLEX_ENABLED
+// Outgoing frame, frame is only used for receiving in duplex mode
+static packet_frame_t duplex_frame;
+
+// Last valid packet received, bytes stay buffered until it has been fetched
+static packet_t duplex_packet;
+static bool duplex_received = false;
+#endif
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+static _uart_autobaud_t autobaud = UART_AUTOBAUD_OFF;
+static uint8_t autobaud_errors = 0;
+
+// Idle time in cycles ending the frame that was measured
+static uint16_t settle_cycles = 0;
+#endif
+
 
 // Private functions
-static void _uart_enable_tx(void);
-static void _uart_disable_tx(void);
-static void _uart_enable_rx(void);
-static void _uart_disable_rx(void);
+static bool _uart_ring_put(_uart_ring_t *ring, uint8_t byte);
+static bool _uart_ring_get(_uart_ring_t *ring, uint8_t *byte);
+static bool _uart_ring_is_empty(const _uart_ring_t *ring);
+
+static void _uart_start_tx(const uint8_t *data, uint8_t length);
+static void _uart_fill_tx(void);
+static bool _uart_is_tx_done(void);
+static void _uart_stop_tx(void);
+static void _uart_flush(void);
+
+static void _uart_receive_packet_byte(uint8_t byte);
+static void _uart_receive_ack_byte(uint8_t byte);
+
+#if EPRO_FULL_DUPLEX_ENABLED
+static void _uart_start_duplex(void);
+static void _uart_receive_duplex_byte(uint8_t byte);
+#endif
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+static void _uart_autobaud(void);
+static bool _uart_measure_frame(uint16_t *cycles);
+static bool _uart_wait_for_edge(bool high, uint16_t start, uint16_t limit, uint16_t *time);
+static bool _uart_wait_for_rxd(bool high, uint16_t start, uint16_t limit, uint16_t *time);
+static void _uart_verify_rate(bool valid);
+static void _uart_stop_autobaud(void);
+#endif
 
 
 // Tx register empty interrupt
 ISR(USART_UDRE_vect)
 {
-    if (mode == UART_MODE_PACKET_TX)
+#if EPRO_RS232_MULTIDROP_ENABLED
+    // The ninth bit marks address frames, it has to be set before UDR is written
+    if (tx_address)
     {
-        if (packet_buffer_position < sizeof(packet_t))
-            UDR = packet_buffer[packet_buffer_position++];
-        else
-        {
-            _uart_disable_tx();
-            mode = UART_MODE_ACK_RX;
-            _uart_enable_rx();
-        }
+        UCSRB |= (1<<TXB8);
+        UDR = bus_peer;
+        tx_address = false;
+        return;
     }
 
-    else if (mode == UART_MODE_ACK_TX)
-    {
-        if (!ack_sent)
-        {
-            UDR = ack;
-            ack_sent = true;
-        }
-        else
-        {
-            _uart_disable_tx();
-            mode = UART_MODE_IDLE;
-
-            if (ack == ASCII_ACK && current_packet)
-            {
-                memcpy(current_packet, packet_buffer, sizeof(packet_t));
-                current_packet = 0;
-            }
+    UCSRB &= ~(1<<TXB8);
+#endif
 
-            _uart_status.result = (ack == ASCII_ACK) ? RESULT_SUCCESS : RESULT_FAILED;
-            _uart_status.done = true;
-        }
-    }
+    uint8_t byte;
+    if (_uart_ring_get(&tx_ring, &byte))
+        UDR = byte;
+    else
+        UCSRB &= ~(1<<UDRIE);
 }
 
 
-// Rx complete interrupt
+// Rx complete interrupt, bytes not fitting into the buffer are dropped
 ISR(USART_RXC_vect)
 {
-    if (mode == UART_MODE_PACKET_RX)
+#if EPRO_RS232_MULTIDROP_ENABLED
+    // With MPCM set only address frames get here. Data frames following
+    // somebody else's address are ignored by the hardware. Writing a one
+    // to TXC would clear it, so only U2X is kept.
+    if (UCSRB & (1<<RXB8))
     {
-        if (packet_buffer_position >= sizeof(packet_t))
-            return;
-
-        uint8_t byte = UDR;
-        if (byte == PACKET_MAGIC_NUMBER)
-            packet_buffer_position = 0;
-
-        packet_buffer[packet_buffer_position++] = byte;
-        if (packet_buffer_position >= sizeof(packet_t))
-        {
-            _uart_disable_rx();
-
-            // Compute checksum
-            packet_t *packet = (packet_t*)packet_buffer;
-            uint8_t checksum = packet_compute_checksum(packet);
-            ack = (checksum == packet->checksum) ? ASCII_ACK : ASCII_NACK;
-            ack_sent = false;
-
-            mode = UART_MODE_ACK_TX;
-            _uart_enable_tx();
-        }
+        uint8_t mpcm = (UDR == bus_address) ? 0 : (1<<MPCM);
+        UCSRA = (UCSRA & (1<<U2X)) | mpcm;
+        return;
     }
+#endif
 
-    else if (mode == UART_MODE_ACK_RX)
-    {
-        ack = UDR;
-
-        _uart_disable_rx();
-        mode = UART_MODE_IDLE;
-
-        _uart_status.result = (ack == ASCII_ACK) ? RESULT_SUCCESS : RESULT_FAILED;
-        _uart_status.done = true;
-    }
+    _uart_ring_put(&rx_ring, UDR);
 }
 
 
 void _uart_initialize()
 {
+    // A rate change must not cut off the last acknowledgement
+    _uart_flush();
+
     // Initialize port D as output
     DDRD |= (1<<_UART_PIN_TXD) | (1<<_UART_PIN_RXD) | (1<<_UART_PIN_IR_ENABLE);
     PORTD &= ~((1<<_UART_PIN_TXD) | (1<<_UART_PIN_RXD) | (1<<_UART_PIN_IR_ENABLE));
 
-    // Enable transmitter & receiver
-    UCSRB = (1<<TXEN) | (1<<RXEN);
+    // Enable transmitter & receiver, received bytes are always buffered
+    UCSRB = (1<<TXEN) | (1<<RXEN) | (1<<RXCIE);
 
     // Set frame format to 8N1
     UCSRC = (1<<URSEL) | (1<<UCSZ0) | (1<<UCSZ1);
 
     // Clear rx buffer
     do UDR; while (UCSRA & (1<<RXC));
+
+    _uart_stop_tx();
+    tx_active = false;
+    rx_ring.head = rx_ring.tail;
+
+    mode = UART_MODE_IDLE;
+    _uart_status.ack_requested = false;
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+    _uart_stop_autobaud();
+#endif
+
+#if EPRO_RS232_MULTIDROP_ENABLED
+    // IrDA shares the UART & keeps using 8N1 frames
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        UCSRA &= ~(1<<MPCM);
+    }
+    multidrop = false;
+#endif
+}
+
+
+#if EPRO_RS232_MULTIDROP_ENABLED
+void _uart_enable_multidrop()
+{
+    // Switch to 9N1 frames & ignore everything until addressed
+    UCSRB |= (1<<UCSZ2);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        UCSRA = (UCSRA & (1<<U2X)) | (1<<MPCM);
+    }
+    multidrop = true;
+}
+
+
+void _uart_set_bus_addresses(uint8_t address, uint8_t peer)
+{
+    bus_address = address;
+    bus_peer = peer;
 }
+#endif
+
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+void _uart_start_autobaud()
+{
+    // Timer1 counts CPU cycles while searching, it is only used by the benchmark otherwise
+    TCCR1A = 0x00;
+    TCCR1B = (1<<CS10);
+
+    autobaud = UART_AUTOBAUD_SEARCH;
+}
+#endif
 
 
-void _uart_set_baudrate(uint32_t baudrate)
+int16_t _uart_set_baudrate(uint32_t baudrate)
 {
-    // See ATmega32 datasheet pages 141-143
-    uint16_t ubrr = ((float)F_CPU / (16*baudrate)) - 1;
-    UBRRH = (uint8_t)(ubrr>>8);
-    UBRRL = (uint8_t)ubrr;
+    if (baudrate > UART_MAX_BAUDRATE)
+        baudrate = UART_MAX_BAUDRATE;
+
+    // Same rounding as UART_DIVISOR(), with integer math at runtime
+    uart_divisor_t divisor = { 0, false };
+    int32_t error = 0;
+
+    for (uint8_t u2x = 0; u2x <= 1; ++u2x)
+    {
+        uint32_t divider = 8UL * (2 - u2x) * baudrate;
+        uint32_t ubrr = (F_CPU + divider/2) / divider;
+        if (ubrr > 0)
+            ubrr--;
+
+        if (ubrr > 4095)
+            ubrr = 4095;
+
+        int32_t rate_error = (int32_t)(F_CPU / (8UL * (2 - u2x) * (ubrr + 1))) - (int32_t)baudrate;
+
+        // Normal mode samples more often, so it is kept unless double speed is closer
+        if (u2x == 0 || labs(rate_error) < labs(error))
+        {
+            divisor.ubrr = ubrr;
+            divisor.u2x = u2x;
+            error = rate_error;
+        }
+    }
+
+    _uart_set_divisor(&divisor);
+
+    // Achieved error in tenths of a percent
+    return (int16_t)(error * 1000 / (int32_t)baudrate);
+}
+
+
+void _uart_set_divisor(const uart_divisor_t *divisor)
+{
+    // The rx interrupt toggles MPCM in the same register
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (divisor->u2x)
+            UCSRA |= (1<<U2X);
+        else
+            UCSRA &= ~(1<<U2X);
+    }
+
+    UBRRH = (uint8_t)(divisor->ubrr>>8);
+    UBRRL = (uint8_t)divisor->ubrr;
 }
 
 
@@ -196,85 +383,642 @@ void _uart_set_ir_enabled(bool enable)
 
 void _uart_shutdown(void)
 {
+    // Let the last acknowledgement leave before disabling the transmitter
+    _uart_flush();
+
     // Disable receiver and transmitter
     UCSRB = 0x00;
+
+    _uart_stop_tx();
+    rx_ring.head = rx_ring.tail;
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+    _uart_stop_autobaud();
+#endif
 }
 
 
 void _uart_send_byte(uint8_t byte)
 {
-    while (!(UCSRA & (1<<UDRE)))
-        ;
+    // Used in IrDA command mode, the byte has to be out before the mode changes
+    static uint8_t command;
+    command = byte;
+
+    _uart_start_tx(&command, 1);
+    _uart_flush();
+}
+
+
+void _uart_process()
+{
+    _uart_fill_tx();
+
+    switch (mode)
+    {
+        case UART_MODE_PACKET_TX:
+            if (!_uart_is_tx_done())
+                break;
+
+            if (immediate_ack)
+                mode = UART_MODE_ACK_RX;
+            else
+            {
+                // Windowed mode, the next packet follows right away
+                mode = UART_MODE_IDLE;
+
+                _uart_status.result = RESULT_SUCCESS;
+                _uart_status.done = true;
+            }
+
+            break;
+
+        case UART_MODE_POLL_TX:
+            if (_uart_is_tx_done())
+                mode = UART_MODE_ACK_RX;
+
+            break;
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+        case UART_MODE_AUTOBAUD:
+            _uart_autobaud();
+            break;
+#endif
+
+        case UART_MODE_ACK_TX:
+            if (!_uart_is_tx_done())
+                break;
 
-    UDR = byte;
+            if (!immediate_ack)
+            {
+                // Go on listening for the next packet
+                packet_frame_reset(&frame);
+                mode = UART_MODE_PACKET_RX;
+
+                _uart_status.result = RESULT_SUCCESS;
+                _uart_status.done = true;
+                break;
+            }
+
+            mode = UART_MODE_IDLE;
+
+            if (ack == ASCII_ACK && current_packet)
+            {
+                packet_frame_decode(&frame, current_packet);
+                current_packet = 0;
+            }
+
+            _uart_status.result = (ack == ASCII_ACK) ? RESULT_SUCCESS : RESULT_FAILED;
+            _uart_status.done = true;
+
+            break;
+
+        default:
+            break;
+    }
+
+    // Framing & checksums run here rather than in the interrupt handler
+    uint8_t byte;
+    while ((mode == UART_MODE_PACKET_RX || mode == UART_MODE_ACK_RX) && _uart_ring_get(&rx_ring, &byte))
+    {
+        _uart_status.active = true;
 
-    while (!(UCSRA & (1<<UDRE)))
-        ;
+        if (mode == UART_MODE_PACKET_RX)
+            _uart_receive_packet_byte(byte);
+        else
+            _uart_receive_ack_byte(byte);
+    }
+
+#if EPRO_FULL_DUPLEX_ENABLED
+    while (mode == UART_MODE_DUPLEX && !duplex_received && _uart_ring_get(&rx_ring, &byte))
+    {
+        _uart_status.active = true;
+        _uart_receive_duplex_byte(byte);
+    }
+#endif
 }
 
 
-void _uart_send_packet(const packet_t *packet)
+void _uart_send_packet(const packet_t *packet, bool immediate)
 {
-    // Initialize packet buffer
-    memcpy(packet_buffer, packet, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // Initialize frame buffer
+    packet_frame_encode(&frame, packet);
+    immediate_ack = immediate;
     mode = UART_MODE_PACKET_TX;
 
+    // Only the answer to this packet is of interest
+    rx_ring.head = rx_ring.tail;
+
     // Start transmission
     _uart_status.result = RESULT_FAILED;
     _uart_status.done = false;
 
-    _uart_enable_tx();
+    _uart_start_tx(frame.data, frame.length);
 }
 
 
-void _uart_read_packet(packet_t *packet)
+void _uart_read_packet(packet_t *packet, bool immediate)
 {
-    // Initialize packet_buffer
-    memset(packet_buffer, 0, sizeof(packet_t));
-    packet_buffer_position = 0;
+    // A pending acknowledgement request needs to be answered first
+    if (_uart_status.ack_requested)
+        return;
+
+#if PACKET_QUEUE_ENABLED
+    // Hand over queued packets first, then answer a deferred poll
+    if (!immediate && !immediate_ack && (mode == UART_MODE_PACKET_RX || poll_pending))
+    {
+        _uart_status.result = RESULT_FAILED;
+        _uart_status.done = false;
+
+        if (packet_queue_pop(&queue, packet))
+        {
+            _uart_status.result = RESULT_SUCCESS;
+            _uart_status.done = true;
+        }
+        else if (poll_pending)
+        {
+            poll_pending = false;
+
+            _uart_status.ack_requested = true;
+            _uart_status.result = RESULT_SUCCESS;
+            _uart_status.done = true;
+        }
+        else
+        {
+            // Already listening, keep partially received packet
+            current_packet = packet;
+        }
+
+        return;
+    }
+#else
+    // Already listening in windowed mode, keep partially received packet
+    if (!immediate && !immediate_ack && mode == UART_MODE_PACKET_RX)
+    {
+        _uart_status.result = RESULT_FAILED;
+        _uart_status.done = false;
+        current_packet = packet;
+        return;
+    }
+#endif
+
+    immediate_ack = immediate;
+
+    // Initialize frame buffer
+    packet_frame_reset(&frame);
     mode = UART_MODE_PACKET_RX;
+#if EPRO_RS232_AUTOBAUD_ENABLED
+    if (autobaud == UART_AUTOBAUD_SEARCH || autobaud == UART_AUTOBAUD_SETTLE)
+        mode = UART_MODE_AUTOBAUD;
+#endif
+#if PACKET_QUEUE_ENABLED
+    packet_queue_reset(&queue);
+    poll_pending = false;
+#endif
 
     // Clear receive buffer
-    do UDR; while (UCSRA & (1<<RXC));
+    rx_ring.head = rx_ring.tail;
 
     // Wait for incoming transmission
     _uart_status.result = RESULT_FAILED;
     _uart_status.done = false;
     current_packet = packet;
-
-    _uart_enable_rx();
 }
 
 
 void _uart_abort()
 {
-    _uart_disable_tx();
-    _uart_disable_rx();
+    _uart_stop_tx();
 
     mode = UART_MODE_IDLE;
+    _uart_status.ack_requested = false;
+#if PACKET_QUEUE_ENABLED
+    poll_pending = false;
+#endif
+}
+
+
+void _uart_send_ack(const packet_ack_t *ack)
+{
+    // Initialize ack buffer
+    memcpy(ack_buffer, ack, sizeof(packet_ack_t));
+    immediate_ack = false;
+    mode = UART_MODE_ACK_TX;
+
+    // Start transmission
+    _uart_status.ack_requested = false;
+    _uart_status.result = RESULT_FAILED;
+    _uart_status.done = false;
+
+    _uart_start_tx(ack_buffer, sizeof(packet_ack_t));
+}
+
+
+void _uart_read_ack(packet_ack_t *ack)
+{
+    static const uint8_t poll = ASCII_ENQ;
+
+    // Initialize ack buffer
+    memset(ack_buffer, 0, sizeof(packet_ack_t));
+    ack_buffer_position = 0;
+    immediate_ack = false;
+    mode = UART_MODE_POLL_TX;
+
+    // Clear receive buffer
+    rx_ring.head = rx_ring.tail;
+
+    // Send poll request & wait for acknowledgement
+    _uart_status.result = RESULT_FAILED;
+    _uart_status.done = false;
+    current_ack = ack;
+
+    _uart_start_tx(&poll, 1);
+}
+
+
+#if EPRO_FULL_DUPLEX_ENABLED
+bool _uart_post_packet(const packet_t *packet)
+{
+    _uart_start_duplex();
+
+    // Transmit buffer is free once the previous frame has been handed to the UART
+    if (!_uart_is_tx_done())
+        return false;
+
+    packet_frame_encode(&duplex_frame, packet);
+    _uart_start_tx(duplex_frame.data, duplex_frame.length);
+
+    return true;
+}
+
+
+bool _uart_fetch_packet(packet_t *packet)
+{
+    _uart_start_duplex();
+
+    if (!duplex_received)
+        return false;
+
+    packet_copy(packet, &duplex_packet);
+    duplex_received = false;
+
+    return true;
+}
+#endif
+
+
+bool _uart_ring_put(_uart_ring_t *ring, uint8_t byte)
+{
+    uint8_t tail = ring->tail;
+    if ((uint8_t)(tail - ring->head) > ring->mask)
+        return false;
+
+    ring->data[tail & ring->mask] = byte;
+    ring->tail = tail + 1;
+
+    return true;
+}
+
+
+bool _uart_ring_get(_uart_ring_t *ring, uint8_t *byte)
+{
+    uint8_t head = ring->head;
+    if (head == ring->tail)
+        return false;
+
+    *byte = ring->data[head & ring->mask];
+    ring->head = head + 1;
+
+    return true;
+}
+
+
+bool _uart_ring_is_empty(const _uart_ring_t *ring)
+{
+    return (ring->head == ring->tail);
+}
+
+
+void _uart_start_tx(const uint8_t *data, uint8_t length)
+{
+    tx_source = data;
+    tx_length = length;
+    tx_position = 0;
+
+    // Clear transmit complete flag, it tells when the last byte has left.
+    // The rx interrupt toggles MPCM in the same register.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        UCSRA |= (1<<TXC);
+    }
+    tx_active = true;
+
+#if EPRO_RS232_MULTIDROP_ENABLED
+    tx_address = multidrop;
+#endif
+
+    // Fill the buffer right away, frames fitting into it go out without further calls
+    _uart_fill_tx();
 }
 
 
-void _uart_enable_tx()
+void _uart_fill_tx()
 {
+    if (tx_position >= tx_length)
+        return;
+
+    // The interrupt handler only moves bytes from the buffer to UDR
+    while (tx_position < tx_length && _uart_ring_put(&tx_ring, tx_source[tx_position]))
+        tx_position++;
+
     UCSRB |= (1<<UDRIE);
 }
 
 
-void _uart_disable_tx()
+bool _uart_is_tx_done()
+{
+    return (tx_position >= tx_length && _uart_ring_is_empty(&tx_ring));
+}
+
+
+void _uart_stop_tx()
 {
     UCSRB &= ~(1<<UDRIE);
+#if EPRO_RS232_MULTIDROP_ENABLED
+    tx_address = false;
+#endif
+
+    tx_ring.tail = tx_ring.head;
+    tx_length = 0;
+    tx_position = 0;
 }
 
 
-void _uart_enable_rx()
+void _uart_flush()
 {
-    UCSRB |= (1<<RXCIE);
+    if (!tx_active)
+        return;
+
+    while (tx_position < tx_length || !_uart_ring_is_empty(&tx_ring) || !(UCSRA & (1<<TXC)))
+        _uart_process();
+
+    tx_active = false;
 }
 
 
-void _uart_disable_rx()
+void _uart_receive_packet_byte(uint8_t byte)
 {
-    UCSRB &= ~(1<<RXCIE);
+    // In windowed mode the sender polls for an acknowledgement between packets
+    if (!immediate_ack && byte == ASCII_ENQ && packet_frame_is_empty(&frame))
+    {
+        // The poll ends the read, later frames must not land in the caller's packet
+        mode = UART_MODE_IDLE;
+        current_packet = 0;
+
+#if PACKET_QUEUE_ENABLED
+        if (!packet_queue_is_empty(&queue))
+        {
+            poll_pending = true;
+            return;
+        }
+#endif
+
+        _uart_status.ack_requested = true;
+        _uart_status.result = RESULT_SUCCESS;
+        _uart_status.done = true;
+        return;
+    }
+
+    if (!packet_frame_push(&frame, byte))
+        return;
+
+    if (!immediate_ack)
+    {
+        // Hand over valid packets and keep listening, packets arriving
+        // before the next call to _uart_read_packet() are queued if possible
+        if (current_packet)
+        {
+            bool valid = packet_frame_is_valid(&frame);
+            if (valid)
+                packet_frame_decode(&frame, current_packet);
+#if EPRO_RS232_AUTOBAUD_ENABLED
+            _uart_verify_rate(valid);
+#endif
+
+            current_packet = 0;
+
+            _uart_status.result = valid ? RESULT_SUCCESS : RESULT_FAILED;
+            _uart_status.done = true;
+        }
+#if PACKET_QUEUE_ENABLED
+        else
+            packet_queue_push(&queue, &frame);
+#endif
+
+        packet_frame_reset(&frame);
+#if EPRO_RS232_AUTOBAUD_ENABLED
+        if (autobaud == UART_AUTOBAUD_SEARCH)
+            mode = UART_MODE_AUTOBAUD;
+#endif
+    }
+    else
+    {
+        // Verify checksum
+        ack = packet_frame_is_valid(&frame) ? ASCII_ACK : ASCII_NACK;
+#if EPRO_RS232_AUTOBAUD_ENABLED
+        _uart_verify_rate(ack == ASCII_ACK);
+#endif
+
+        mode = UART_MODE_ACK_TX;
+        _uart_start_tx(&ack, 1);
+    }
+}
+
+
+void _uart_receive_ack_byte(uint8_t byte)
+{
+    if (!immediate_ack)
+    {
+        ack_buffer[ack_buffer_position++] = byte;
+        if (ack_buffer_position < sizeof(packet_ack_t))
+            return;
+
+        mode = UART_MODE_IDLE;
+
+        memcpy(current_ack, ack_buffer, sizeof(packet_ack_t));
+        current_ack = 0;
+
+        _uart_status.result = packet_ack_is_valid((packet_ack_t*)ack_buffer) ? RESULT_SUCCESS
+                                                                             : RESULT_FAILED;
+        _uart_status.done = true;
+        return;
+    }
+
+    ack = byte;
+    mode = UART_MODE_IDLE;
+
+    _uart_status.result = (ack == ASCII_ACK) ? RESULT_SUCCESS : RESULT_FAILED;
+    _uart_status.done = true;
+}
+
+
+#if EPRO_RS232_AUTOBAUD_ENABLED
+void _uart_autobaud()
+{
+    // Bytes received at the old rate are of no use
+    rx_ring.head = rx_ring.tail;
+
+    if (autobaud == UART_AUTOBAUD_SEARCH)
+    {
+        uint16_t cycles;
+        if (!_uart_measure_frame(&cycles))
+            return;
+
+        _uart_set_baudrate((10 * F_CPU + cycles/2) / cycles);
+
+        // Somewhat longer than a byte, so the rest of the frame is skipped
+        settle_cycles = cycles + cycles/4;
+        autobaud = UART_AUTOBAUD_SETTLE;
+        return;
+    }
+
+    // Line has to be idle before the receiver can find the next start bit
+    if (_uart_wait_for_rxd(false, TCNT1, settle_cycles, 0))
+        return;
+
+    TCCR1B = 0x00;
+    rx_ring.head = rx_ring.tail;
+
+    // First frame has to be valid to confirm the rate
+    autobaud = UART_AUTOBAUD_LOCKED;
+    autobaud_errors = _UART_AUTOBAUD_MAX_ERRORS - 1;
+
+    packet_frame_reset(&frame);
+    mode = UART_MODE_PACKET_RX;
+
+    // Let a stop-and-wait sender repeat the lost packet right away
+    if (immediate_ack)
+    {
+        ack = ASCII_NACK;
+        _uart_start_tx(&ack, 1);
+    }
+}
+
+
+bool _uart_measure_frame(uint16_t *cycles)
+{
+    uint16_t start = TCNT1;
+    uint16_t fall, rise, next;
+
+    // The magic number 0xfe keeps the line low for the start bit & bit 0, then
+    // high until the start bit of the following byte ten bits after the first
+    // edge. Senders have to send that byte right behind the magic number.
+    if (!_uart_wait_for_edge(false, start, _UART_AUTOBAUD_TIMEOUT, &fall)
+        || !_uart_wait_for_edge(true, fall, _UART_AUTOBAUD_MAX_CYCLES / 5, &rise)
+        || !_uart_wait_for_edge(false, fall, _UART_AUTOBAUD_MAX_CYCLES, &next))
+        return false;
+
+    uint16_t low = rise - fall;
+    *cycles = next - fall;
+
+    // Anything but two low & eight high bits is not the start of a frame
+    return (*cycles >= _UART_AUTOBAUD_MIN_CYCLES
+            && 4UL*low <= *cycles && *cycles <= 6UL*low);
 }
+
+
+bool _uart_wait_for_edge(bool high, uint16_t start, uint16_t limit, uint16_t *time)
+{
+    bool found = false;
+    bool missed = false;
+
+    do
+    {
+        // Interrupts would delay the edge, so they are only held off for a slice
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            // An edge passing while interrupts were served can't be timed
+            missed = ((PIND & (1<<_UART_PIN_RXD)) != 0) == high;
+            if (!missed)
+                found = _uart_wait_for_rxd(high, TCNT1, _UART_AUTOBAUD_SLICE, time);
+        }
+    }
+    while (!found && !missed && (uint16_t)(TCNT1 - start) <= limit);
+
+    return found;
+}
+
+
+bool _uart_wait_for_rxd(bool high, uint16_t start, uint16_t limit, uint16_t *time)
+{
+    uint16_t now;
+    do
+    {
+        now = TCNT1;
+        bool level = (PIND & (1<<_UART_PIN_RXD)) != 0;
+        if (level == high)
+        {
+            if (time)
+                *time = now;
+
+            return true;
+        }
+    }
+    while ((uint16_t)(now - start) <= limit);
+
+    return false;
+}
+
+
+void _uart_verify_rate(bool valid)
+{
+    if (autobaud != UART_AUTOBAUD_LOCKED)
+        return;
+
+    if (valid)
+        autobaud_errors = 0;
+    else if (++autobaud_errors >= _UART_AUTOBAUD_MAX_ERRORS)
+        _uart_start_autobaud();
+}
+
+
+void _uart_stop_autobaud()
+{
+    if (autobaud != UART_AUTOBAUD_OFF && autobaud != UART_AUTOBAUD_LOCKED)
+        TCCR1B = 0x00;
+
+    autobaud = UART_AUTOBAUD_OFF;
+}
+#endif
+
+
+#if EPRO_FULL_DUPLEX_ENABLED
+void _uart_start_duplex()
+{
+    if (mode == UART_MODE_DUPLEX)
+        return;
+
+    // Both directions run independently from now on, bytes already
+    // received belong to the other end's first frame
+    _uart_stop_tx();
+    packet_frame_reset(&frame);
+    duplex_received = false;
+
+    mode = UART_MODE_DUPLEX;
+    _uart_status.ack_requested = false;
+}
+
+
+void _uart_receive_duplex_byte(uint8_t byte)
+{
+    if (!packet_frame_push(&frame, byte))
+        return;
+
+    if (packet_frame_is_valid(&frame))
+    {
+        packet_frame_decode(&frame, &duplex_packet);
+        duplex_received = true;
+    }
+
+    packet_frame_reset(&frame);
+}
+#endif
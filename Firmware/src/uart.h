@@ -33,15 +33,55 @@
 // These functions are intended for internal
 // use by the RS-232 and IrDA modules only.
 
+// Highest rate possible, double speed mode with UBRR 0
+#define UART_MAX_BAUDRATE (F_CPU / 8)
+
+// Compile-time baud rate divisors, see ATmega32 datasheet pages 141-143. UBRR
+// is rounded to the nearest integer & double speed mode (U2X) is selected if
+// it gets closer to the requested rate.
+#define UART_UBRR(baud, u2x)  ((F_CPU + 4UL*(2 - (u2x))*(baud)) / (8UL*(2 - (u2x))*(baud)) - 1)
+#define UART_RATE(baud, u2x)  (F_CPU / (8UL*(2 - (u2x))*(UART_UBRR(baud, u2x) + 1)))
+#define UART_ERROR(baud, u2x) (UART_RATE(baud, u2x) > (baud) ? UART_RATE(baud, u2x) - (baud) \
+                                                             : (baud) - UART_RATE(baud, u2x))
+#define UART_U2X(baud)        (UART_ERROR(baud, 1) < UART_ERROR(baud, 0))
+#define UART_DIVISOR(baud)    { UART_UBRR(baud, UART_U2X(baud)), UART_U2X(baud) }
+
+// Deviation of the achieved rate in tenths of a percent
+#define UART_ERROR_PERMILLE(baud) (UART_ERROR(baud, UART_U2X(baud)) * 1000 / (baud))
+
+typedef struct
+{
+    uint16_t ubrr;
+    bool u2x;
+
+} uart_divisor_t;
+
 extern interface_status_t _uart_status;
 
 void _uart_initialize(void);
-void _uart_set_baudrate(uint32_t baudrate);
+int16_t _uart_set_baudrate(uint32_t baudrate);
+void _uart_set_divisor(const uart_divisor_t *divisor);
 void _uart_set_ir_enabled(bool enable);
+#if EPRO_RS232_AUTOBAUD_ENABLED
+void _uart_start_autobaud(void);
+#endif
+#if EPRO_RS232_MULTIDROP_ENABLED
+void _uart_enable_multidrop(void);
+void _uart_set_bus_addresses(uint8_t address, uint8_t peer);
+#endif
 void _uart_shutdown(void);
 void _uart_send_byte(uint8_t byte);
-void _uart_send_packet(const packet_t *packet);
-void _uart_read_packet(packet_t *packet);
+void _uart_process(void);
+void _uart_send_packet(const packet_t *packet, bool immediate_ack);
+void _uart_read_packet(packet_t *packet, bool immediate_ack);
 void _uart_abort(void);
 
+void _uart_send_ack(const packet_ack_t *ack);
+void _uart_read_ack(packet_ack_t *ack);
+
+#if EPRO_FULL_DUPLEX_ENABLED
+bool _uart_post_packet(const packet_t *packet);
+bool _uart_fetch_packet(packet_t *packet);
+#endif
+
 #endif // EPRO_UART_H